@@ -52,8 +52,29 @@ typedef unsigned int uint16;
 /*------------Sine Table--------------*/
 
 #define WAVE_TABLE_FULL_LENGTH 512
+#define WAVE_TABLE_FULL_BITS 9 //log2(WAVE_TABLE_FULL_LENGTH)
 #define WAVE_TABLE_SHORT_LENGTH 32
 
+/*------------Waveform presets in program flash. One page per slot--------------*/
+#define WAVE_PRESET_SLOTS 24
+#define WAVE_PRESET_MAGIC 0xA55A //stored after the two tables. Erased flash reads 0xFFFF
+
+/*------------Parametric waveforms--------------*/
+#define WAVE_SINE        0
+#define WAVE_TRIANGLE    1
+#define WAVE_SAWTOOTH    2
+#define WAVE_SQUARE      3 //param = duty, 65536 = 100%
+#define WAVE_EXPONENTIAL 4 //param = decay per table entry, Q16
+#define WAVE_NOISE       5 //param = seed
+
+/*------------DDS--------------*/
+#define DDS_SAMPLE_TICKS 1280 //Fcy ticks between DDS updates. 50KHz, so 1 LSB of the tuning word is 11.6uHz
+#define SWEEP_LOG        1 //equal frequency ratio per step instead of equal difference
+#define SWEEP_REPEAT     2 //restart from the start frequency instead of holding the stop frequency
+#define SWEEP_SYNC_START 4 //SQR1 high during the first step of every sweep
+#define SWEEP_SYNC_STEP  8 //toggle SQR1 at every step
+#define SWEEP_RATIO_MAX  0xFFFFFFFFUL //largest log step ratio, just under 256. Q24, must fit in 32 bits
+
 #define LEDPIN _LATB15   //status LED
 
 #define ACKNOWLEDGE 254
@@ -92,6 +113,11 @@ typedef unsigned int uint16;
 #define SET_CAP 21
 
 #define PULSE_TRAIN 22
+#define CAPTURE_MIXED_SIGNAL 23
+#define GET_MIXED_SIGNAL_TIMING 24
+#define FIT_RC_CURVE 25
+#define GET_ECHO_DELAY 26
+#define GET_BODE 27
 
 /*-----SPI--------*/
 #define SPI 3
@@ -138,6 +164,11 @@ typedef unsigned int uint16;
 #define DAC 6
 #define SET_DAC 1
 #define SET_CALIBRATED_DAC 2
+#define START_DAC_STREAM 3
+#define STOP_DAC_STREAM 4
+#define GET_DAC_STREAM_STATUS 5
+#define FILL_DAC_RAMP 6
+#define LOAD_DAC_STREAM 7
 
 
 /*--------WAVEGEN-----*/
@@ -158,12 +189,31 @@ typedef unsigned int uint16;
 
 #define LOAD_WAVEFORM1 15
 #define LOAD_WAVEFORM2 16
+#define SET_DDS 18
+#define SET_DDS_SWEEP 19
+#define SET_WAVE_LENGTH 20
+#define LOAD_WAVE_SEGMENT 21
+#define GENERATE_WAVEFORM 22
+#define RETUNE_SINE 23
+#define RETUNE_DDS 24
+#define RETUNE_SQR1 25
+#define RETUNE_SQR2 26
+#define RETUNE_SQR4 27
+#define SAVE_WAVE_PRESET 28
+#define RECALL_WAVE_PRESET 29
 
 //#define SQR1_PATTERN  17 //removed
 
 /*-----digital outputs----*/
 #define DOUT 8
 #define SET_STATE 1
+#define START_PATTERN 2
+#define STOP_PATTERN 3
+#define GET_PATTERN_STATUS 4
+#define STEPPER_MOVE 5
+#define STEPPER_STOP 6
+#define STEPPER_STATUS 7
+#define STEPPER_SET_POSITION 8
 
 /*-----digital inputs-----*/
 #define DIN   9
@@ -190,6 +240,15 @@ typedef unsigned int uint16;
 #define START_ALTERNATE_ONE_CHAN_LA 15
 #define START_THREE_CHAN_LA 16
 #define STOP_LA 17
+#define CONFIGURE_LA_TRIGGER 18
+#define FETCH_LA_WRAPS 19
+#define GET_LA_PROGRESS 20
+#define START_TIMING_JOB 21
+#define FETCH_TIMING_JOB 22
+#define START_PHASE_MONITOR 23
+#define STOP_PHASE_MONITOR 24
+#define FETCH_PHASE_MONITOR 25
+#define SET_LA_PROGRESS 26
 
 /*--------MISCELLANEOUS------*/
 #define COMMON 11
@@ -226,6 +285,16 @@ typedef unsigned int uint16;
 #define FETCH_COUNT 26
 
 #define FILL_BUFFER 27
+#define GET_RECIPROCAL_FREQUENCY 28
+#define START_FREQUENCY_MONITOR 29
+#define STOP_FREQUENCY_MONITOR 30
+#define FETCH_FREQUENCY_MONITOR 31
+#define GET_MULTI_FREQUENCY 32
+#define GET_TIMING_HISTOGRAM 33
+#define GET_CAPACITANCE_AUTORANGE 34
+#define GET_CTMU_SWEEP 35
+#define ARM_SYNC_START 36
+#define SYNC_START 37
 
 /*---------- BAUDRATE for main comm channel----*/
 #define SETBAUD				12
@@ -331,6 +400,116 @@ typedef unsigned int uint16;
 #define DMA_LA_ONE_CHAN 1
 #define DMA_LA_TWO_CHAN 2
 #define DMA_LA_FOUR_CHAN 3
+#define DMA_MIXED_SIGNAL 4
+
+/*------PATTERN GENERATOR------*/
+#define PATTERN_IDLE 0
+#define PATTERN_ARMED 1 //waiting for the INT2 trigger
+#define PATTERN_RUNNING 2
+#define PATTERN_DONE 3
+#define PATTERN_LOOP 1 //flags
+#define PATTERN_REUSE 2 //ADCbuffer already holds LATC words from the previous run
+#define PATTERN_MIN_PERIOD 16 //Timer4 ticks per step. Leaves DMA bandwidth for the ADC
+
+/*------STEPPER MOTOR------*/
+#define STEPPER_IDLE 0
+#define STEPPER_MOVING 1
+#define STEPPER_TICK_HZ 20000L //Timer1 rate while stepping. Also the top speed, one step per tick
+#define STEPPER_ONE_STEP (1UL << 24) //speeds and the step accumulator are Q24 steps per tick
+#define STEPPER_RELEASE 1 //flags. Turn the coils off at the target
+
+/*------DAC STREAM. MCP4728 fast writes from DAC_STREAM_TABLE, paced by Timer2------*/
+#define DAC_STREAM_IDLE 0
+#define DAC_STREAM_RUNNING 1
+#define DAC_STREAM_DONE 2
+#define DAC_STREAM_NACK 3
+#define DAC_STREAM_LOOP 1 //flags
+#define DAC_STREAM_CHANNELS 4 //words per frame. Channel A-D, 12 bit
+#define DAC_STREAM_MAX_FRAMES 128 //own table, so that scope captures into ADCbuffer can run alongside. 1kB
+#define DAC_STREAM_MIN_PERIOD 250 //uS. One frame is 9 bytes at ~400kHz
+
+/*------SYNCHRONISED START. Timers held back by the setup functions until SYNC_START------*/
+#define SYNC_ADC 1 //Timer5, scope captures
+#define SYNC_SINE2 2 //Timer3
+#define SYNC_SINE1 4 //Timer4
+#define SYNC_SQR 8 //Timer1
+#define SYNC_TIMERS 4 //started one instruction cycle apart, in the order above
+#define SYNC_NOT_STARTED 0xFF //SYNC_START offset of a timer left out of the mask
+
+/*------FREQUENCY MONITOR------*/
+#define FREQ_MONITOR_LENGTH (BUFFER_SIZE / 2) //32 bit readings held in ADCbuffer
+
+/*------MULTI CHANNEL FREQUENCY------*/
+#define MULTI_FREQ_EDGES 4 //edges captured per channel. rising/falling alternate
+
+/*------TIMING HISTOGRAM------*/
+#define HISTOGRAM_PERIOD 0
+#define HISTOGRAM_HIGH   1
+#define HISTOGRAM_LOW    2
+
+/*------PHASE MONITOR------*/
+#define PHASE_MONITOR_LENGTH (BUFFER_SIZE / 4) //[delay, period] 32 bit pairs held in ADCbuffer
+
+/*------CAPACITANCE AUTO RANGING------*/
+#define CAP_WINDOW_LOW    1024 //acceptable 12 bit CTMU reading
+#define CAP_WINDOW_HIGH   3072
+#define CAP_TARGET        2048
+#define CAP_SATURATED     4000
+#define CAP_MIN_CHARGE    4 //Timer5 ticks at 1:64 (1uS)
+#define CAP_MAX_CHARGE    50000
+#define CAP_MAX_ATTEMPTS  8
+
+/*------DISCHARGE SETTLING------*/
+#define CAP_DISCHARGED      20 //12 bit reading treated as empty (16mV)
+#define CAP_SETTLE_SAMPLES  8 //consecutive readings below CAP_DISCHARGED
+#define CTMU_STARTUP_US     1000 //current source warm up, kept at the original fixed value
+#define CTMU_SETTLE_TIMEOUT 1500 //the old fixed 1500uS drain is now the upper bound
+
+/*------RC CURVE FIT------*/
+#define FIT_BASELINE          8 //codes. Points this close to V-infinity are noise, not decay
+#define FIT_SATURATION_MARGIN 4 //codes from either rail
+#define FIT_MIN_POINTS        8
+#define FIT_OK          0
+#define FIT_TOO_FEW     1
+#define FIT_NOT_DECAYING 2
+#define FIT_BUSY        3
+
+/*------ECHO DELAY------*/
+#define ECHO_OK       0
+#define ECHO_NO_ROOM  1 //template does not fit after the capture
+#define ECHO_NO_PEAK  2
+#define ECHO_BUSY     3 //capture still running
+
+/*------BODE ANALYSER------*/
+#define BODE_MAX_POINTS        128
+#define BODE_SAMPLES_PER_CYCLE 32
+#define BODE_MIN_DELAY         16 //Timer5 ticks (2uS). Two channel ADC interrupt capture
+
+/*------CTMU SWEEP------*/
+#define CTMU_SWEEP_MAX 256 //steps. [IRNG(2 msb) | ITRIM(6 lsb)] each. 0 steps => full grid
+
+/*------BACKGROUND TIMING JOBS------*/
+#define TIMING_JOB_NONE 0
+#define TIMING_JOB_TIMING 1     //GET_TIMING
+#define TIMING_JOB_MEASUREMENTS 2   //TIMING_MEASUREMENTS
+#define TIMING_JOB_INTERVAL 3   //INTERVAL_MEASUREMENTS
+#define TIMING_JOB_FREQUENCY 4  //GET_FREQUENCY
+#define TIMING_JOB_HCSR04 5     //HCSR04
+#define TIMING_JOB_MAX_PAIRS 4  //depth of the input capture FIFO
+
+#define TIMING_JOB_BUSY 0
+#define TIMING_JOB_DONE 1
+#define TIMING_JOB_TIMEOUT 2
+#define TIMING_JOB_OVERFLOW 4
+
+/*------LOGIC ANALYZER TRIGGER ENGINE------*/
+#define LA_TRIGGER_MAX_STAGES 4
+#define LA_TRIGGER_EDGE_CHANNEL 0x07 //1-4 => ID1-ID4 , 0 => pattern only. 5-7 are rejected
+#define LA_TRIGGER_EDGE_FALLING 0x08
+
+/*------LOGIC ANALYZER 32 BIT TIMESTAMPS------*/
+#define LA_EMPTY_SLOT 0x0000 //prefilled into capture buffers to locate the DMA write position. See LA_write_index
+#define LA_MAX_WRAP_ENTRIES 32
 
 
 /*-------ACKNOWLEDGE BYTES-----*/
@@ -38,4 +38,35 @@ void logit(char *str){
         if(error_writepos==&errors[ERROR_BUFFLEN])
             error_writepos=&errors[0];
     }
-}
\ No newline at end of file
+}
+
+BYTE SYNC_HOLD = 0; //SYNC_* bits. The setup functions leave these timers stopped for sync_start.
+//Firmware routines that wait on these timers themselves (GET_BODE) refuse to run while it is set
+
+void sync_start(BYTE mask, uint16 *counts) {
+    /* Set TON of the held timers one instruction cycle apart, Timer5, Timer3, Timer4 then Timer1 : timer n of that
+     * order starts n Fcy cycles after Timer5. Timers left out of the mask get the same write slot on a dummy variable,
+     * so the spacing never changes. Writing TxCON clears the prescalers, and the TMR presets (eg. the sine 2 delay)
+     * are kept. counts[] : TMR5, TMR3, TMR4, TMR1 read back to back right after, for the host to check the offsets*/
+    volatile uint16 dummy;
+    volatile uint16 *r5, *r3, *r4, *r1;
+    uint16 t5, t3, t4, t1;
+    BYTE ipl = SRbits.IPL;
+    r5 = (mask & SYNC_ADC) ? &T5CON : &dummy;
+    r3 = (mask & SYNC_SINE2) ? &T3CON : &dummy;
+    r4 = (mask & SYNC_SINE1) ? &T4CON : &dummy;
+    r1 = (mask & SYNC_SQR) ? &T1CON : &dummy;
+    SRbits.IPL = 7; //no interrupts between reading the control registers and starting
+    t5 = *r5 | 0x8000;
+    t3 = *r3 | 0x8000;
+    t4 = *r4 | 0x8000;
+    t1 = *r1 | 0x8000;
+    __asm__ volatile ("mov %4, [%0]\n\tmov %5, [%1]\n\tmov %6, [%2]\n\tmov %7, [%3]"
+            : : "r"(r5), "r"(r3), "r"(r4), "r"(r1), "r"(t5), "r"(t3), "r"(t4), "r"(t1) : "memory");
+    counts[0] = TMR5;
+    counts[1] = TMR3;
+    counts[2] = TMR4;
+    counts[3] = TMR1;
+    SYNC_HOLD = 0;
+    SRbits.IPL = ipl;
+}
@@ -18,5 +18,8 @@ extern void Delay_us_by8(uint16 delay);
 extern void Delay_ms(uint16 delay);
 extern void logit(char *str);
 
+extern BYTE SYNC_HOLD;
+extern void sync_start(BYTE mask, uint16 *counts);
+
 #endif	/* COMMON_FUNCTIONS_H */
 
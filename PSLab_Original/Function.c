@@ -4,6 +4,8 @@
 #include "PSLAB_ADC.h"
 #include "PSLAB_SPI.h"
 #include "Measurements.h"
+#include "Wave_Generator.h"
+#include "PSLAB_I2C.h"
 
 int *endbuff;
 int *buffpointer, *endpointer, dma_channel_length, I2CSamples;
@@ -11,6 +13,8 @@ BYTE *bytebuff1, *bytebuff2;
 //__eds__ unsigned int ADCbuffer[BUFFER_SIZE] __attribute__((space(eds))); 
 int dma_channel_length = 10, I2CSamples = 0;
 __prog__ unsigned int __attribute__((section("CALIBS"), space(prog), aligned(_FLASH_PAGE * 2))) dat1[15][_FLASH_PAGE];
+/*Waveform presets. sineTable[512], sineTable_short[32], WAVE_PRESET_MAGIC, one page each*/
+__prog__ unsigned int __attribute__((section("WAVE_PRESETS"), space(prog), aligned(_FLASH_PAGE * 2))) wavePresets[WAVE_PRESET_SLOTS][_FLASH_PAGE];
 unsigned int dest[_FLASH_ROW * 8];
 unsigned int blk[8];
 
@@ -40,6 +44,10 @@ BYTE frequency_scaling = 1, frequency_ready = FALSE;
 
 /*--------Stepper Motor--------*/
 BYTE motor_phases[] = {12, 6, 3, 9}, current_motor_phase = 0;
+BYTE STEPPER_STATE = STEPPER_IDLE, STEPPER_FLAGS = 0;
+long STEPPER_POSITION = 0, STEPPER_TARGET = 0;
+unsigned long STEPPER_SPEED = 0, STEPPER_MAX_SPEED = 0, STEPPER_ACCEL = 0, STEPPER_FRACTION = 0; //Q24 steps/tick
+unsigned long STEPPER_MIN_SPEED = 0; //speed after one step from rest, sqrt(2*accel). The floor while slowing down
 
 BYTE chan = 1;
 long addr_count = 0xAAAA01;
@@ -54,8 +62,10 @@ BYTE data[32];
 BYTE cb, cc;
 
 void __attribute__((__interrupt__, no_auto_psv)) _DMA0Interrupt(void) {
-    IC1CON2bits.TRIGSTAT = 0;
-    IC1CON1bits.ICM = 0;
+    if (DMA_MODE != DMA_MIXED_SIGNAL) { //IC1 holds the timestamp lsw of the mixed signal capture
+        IC1CON2bits.TRIGSTAT = 0;
+        IC1CON1bits.ICM = 0;
+    }
     DMA0CONbits.CHEN = 0;
     _DMA0IF = 0;
     _DMA0IE = 0; // Clear the DMA0 Interrupt Flag
@@ -76,6 +86,11 @@ void __attribute__((__interrupt__, no_auto_psv)) _DMA1Interrupt(void) {
 }
 
 void __attribute__((__interrupt__, no_auto_psv)) _DMA2Interrupt(void) {
+    if (PATTERN_STATE == PATTERN_RUNNING && DMA2PAD == (volatile uint16) &LATC) {
+        pattern_done();
+        _DMA2IF = 0;
+        return;
+    }
     IC3CON2bits.TRIGSTAT = 0;
     IC3CON1bits.ICM = 0;
     _DMA2IF = 0; // Clear the DMA0 Interrupt Flag
@@ -87,9 +102,54 @@ void __attribute__((__interrupt__, no_auto_psv)) _DMA3Interrupt(void) {
     _DMA3IF = 0; // Clear the DMA0 Interrupt Flag
 }
 
+void __attribute__((__interrupt__, no_auto_psv)) _T4Interrupt(void) { // DDS, sine 1 and period boundary retuning
+    _T4IF = 0;
+    if (RETUNE_SINE1_PENDING) {
+        PR4 = RETUNE_PR4;
+        if (TMR4 >= RETUNE_PR4)TMR4 = 0; //already past the new match. Restart the period instead of wrapping at 0xFFFF
+        RETUNE_SINE1_PENDING = 0;
+    }
+    if (!DDS_ACTIVE1) {
+        _T4IE = 0;
+        return;
+    }
+    DDS_PHASE1 += DDS_TUNING1;
+    OC3R = sineTable1[DDS_PHASE1 >> DDS_SHIFT1];
+    if (DDS_SWEEP_CHANNEL == 1 && !--DDS_SWEEP_COUNT)DDSSweepStep();
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _T3Interrupt(void) { // DDS, sine 2 and period boundary retuning
+    _T3IF = 0;
+    if (RETUNE_SINE2_PENDING) {
+        PR3 = RETUNE_PR3;
+        if (TMR3 >= RETUNE_PR3)TMR3 = 0; //already past the new match
+        if (RETUNE_SINE2_PENDING == 2)OC4R = RETUNE_OC4R; //SQR2
+        RETUNE_SINE2_PENDING = 0;
+    }
+    if (!DDS_ACTIVE2) {
+        _T3IE = 0;
+        return;
+    }
+    DDS_PHASE2 += DDS_TUNING2;
+    OC4R = sineTable2[DDS_PHASE2 >> DDS_SHIFT2];
+    if (DDS_SWEEP_CHANNEL == 2 && !--DDS_SWEEP_COUNT)DDSSweepStep();
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _T1Interrupt(void) { // Stepper motor, SQR1-4 period boundary retuning
+    _T1IF = 0;
+    if (STEPPER_STATE != STEPPER_IDLE) {
+        stepper_tick();
+        return;
+    }
+    _T1IE = 0;
+    if (RETUNE_T1_PENDING)applyTimer1Retune();
+}
+
 void __attribute__((__interrupt__, no_auto_psv)) _CNInterrupt(void) // For four channel Logic analyzer
 {
-    if ((((PORTB >> 10) & DIGITAL_TRIGGER_CHANNEL) > 0) == DIGITAL_TRIGGER_STATE) {
+    if (LA_TRIGGER_STAGES) {
+        if (LA_trigger_process(((PORTB >> 10)&0xF) | (_C4OUT << 4)))release_LA_trigger();
+    } else if ((((PORTB >> 10) & DIGITAL_TRIGGER_CHANNEL) > 0) == DIGITAL_TRIGGER_STATE) {
         _CNIEB10 = 0;
         _CNIEB11 = 0;
         _CNIEB12 = 0;
@@ -111,7 +171,36 @@ void __attribute__((__interrupt__, no_auto_psv)) _CNInterrupt(void) // For four
     // Clear CN interrupt
 }
 
+void __attribute__((__interrupt__, no_auto_psv)) _T5Interrupt(void) { // Frequency monitor gate
+    _T5IF = 0;
+    if (FREQ_MONITOR_RUNNING)frequency_monitor_sample();
+    else _T5IE = 0;
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _T2Interrupt(void) { // Timebase wraps for four channel Logic analyzer, DAC stream
+    _T2IF = 0;
+    if (DAC_STREAM_STATE == DAC_STREAM_RUNNING)dac_stream_tick();
+    else LA_record_wrap();
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _MI2C2Interrupt(void) { // DAC stream bus events
+    _MI2C2IF = 0;
+    dac_stream_next();
+}
+
 void __attribute__((__interrupt__, no_auto_psv)) _INT2Interrupt(void) {
+    if (PATTERN_STATE == PATTERN_ARMED) {
+        release_pattern();
+        _INT2IF = 0;
+        _INT2IE = 0;
+        return;
+    }
+    if (DMA_MODE == DMA_MIXED_SIGNAL) {
+        release_mixed_signal();
+        _INT2IF = 0;
+        _INT2IE = 0;
+        return;
+    }
     IC1CON1bits.ICM = LAM1;
     IC2CON1bits.ICM = LAM2;
     IC3CON1bits.ICM = LAM3;
@@ -128,7 +217,34 @@ void __attribute__((__interrupt__, no_auto_psv)) _INT2Interrupt(void) {
 
 }
 
+void __attribute__((__interrupt__, no_auto_psv)) _IC1Interrupt(void) { // Background timing job pin 1, multi channel frequency, phase monitor or mixed signal edges
+    _IC1IF = 0;
+    if (MULTI_FREQ_CHANNELS)multi_frequency_latch(0);
+    else if (PHASE_MONITOR_RUNNING)phase_monitor_latch(1);
+    else if (TIMING_JOB != TIMING_JOB_NONE && TIMING_JOB_STATE != 3)timing_job_latch(1);
+    else if (DMA_MODE == DMA_MIXED_SIGNAL && MIXED_SIGNAL_EDGES < MIXED_SIGNAL_EDGE_LIMIT)mixed_signal_latch();
+    else _IC1IE = 0;
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _IC2Interrupt(void) { // Multi channel frequency
+    _IC2IF = 0;
+    if (MULTI_FREQ_CHANNELS)multi_frequency_latch(1);
+    else _IC2IE = 0;
+}
+
+void __attribute__((__interrupt__, no_auto_psv)) _IC3Interrupt(void) { // Background timing job pin 2, multi channel frequency or phase monitor
+    _IC3IF = 0;
+    if (MULTI_FREQ_CHANNELS)multi_frequency_latch(2);
+    else if (PHASE_MONITOR_RUNNING)phase_monitor_latch(2);
+    else timing_job_latch(2);
+}
+
 void __attribute__((__interrupt__, no_auto_psv)) _IC4Interrupt(void) {
+    if (MULTI_FREQ_CHANNELS) {
+        _IC4IF = 0;
+        multi_frequency_latch(3);
+        return;
+    }
     INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4); //INITIAL_DIGITAL_STATES =(PORTB>>10)&0xF;
     IC4CON1bits.ICM = 0; //Disable IC4 interrupt
     _IC4IF = 0;
@@ -264,6 +380,102 @@ void setFlashPointer(BYTE location) {
 
 }
 
+BYTE stepper_move(long target, uint16 speed, uint16 accel, BYTE flags) {
+    /* Trapezoidal move on SQR1-SQR4 (RC6-RC9), sequence from motor_phases[]. Timer1 ticks at STEPPER_TICK_HZ,
+     * so the square wave outputs stop. speed : steps/s , accel : steps/s^2 , 0 for no ramp*/
+    unsigned long long square;
+    unsigned long root, bit;
+    if (STEPPER_STATE != STEPPER_IDLE)return 0;
+    stop_pattern(); //both drive RC6-RC9 through LATC
+    T1CON = 0;
+    _T1IE = 0;
+    RETUNE_T1_PENDING = 0;
+    STEPPER_TARGET = target;
+    STEPPER_MAX_SPEED = ((unsigned long long) speed << 24) / STEPPER_TICK_HZ;
+    if (STEPPER_MAX_SPEED > STEPPER_ONE_STEP)STEPPER_MAX_SPEED = STEPPER_ONE_STEP;
+    //one LSB of STEPPER_ACCEL is STEPPER_TICK_HZ^2/2^24 , about 24 steps/s^2. Rounded to the nearest LSB
+    if (accel)STEPPER_ACCEL = (((unsigned long long) accel << 24) + STEPPER_TICK_HZ * STEPPER_TICK_HZ / 2) / (STEPPER_TICK_HZ * STEPPER_TICK_HZ);
+    else STEPPER_ACCEL = STEPPER_MAX_SPEED;
+    if (!STEPPER_ACCEL)STEPPER_ACCEL = 1;
+    square = (unsigned long long) STEPPER_ACCEL << 25; //(2*accel) in Q48
+    root = 0;
+    for (bit = 1UL << 30; bit; bit >>= 1)if ((unsigned long long) (root | bit)*(root | bit) <= square)root |= bit;
+    STEPPER_MIN_SPEED = root < STEPPER_MAX_SPEED ? root : STEPPER_MAX_SPEED;
+    STEPPER_SPEED = 0;
+    STEPPER_FRACTION = 0;
+    STEPPER_FLAGS = flags;
+    if (target == STEPPER_POSITION)return 1;
+
+    RPOR5bits.RP54R = 0;
+    RPOR5bits.RP55R = 0;
+    RPOR6bits.RP56R = 0;
+    RPOR6bits.RP57R = 0; //SQR1-4 follow LATC
+    LATC = (LATC & ~0x03C0) | (motor_phases[current_motor_phase] << 6); //energise the present phase
+
+    PR1 = FP / STEPPER_TICK_HZ - 1;
+    TMR1 = 0;
+    STEPPER_STATE = STEPPER_MOVING;
+    _T1IF = 0;
+    _T1IE = 1;
+    T1CONbits.TON = 1;
+    return 1;
+}
+
+void stepper_stop(BYTE halt) {
+    unsigned long distance;
+    if (STEPPER_STATE == STEPPER_IDLE)return;
+    _T1IE = 0;
+    if (halt) { //stop on this step, speed permitting
+        T1CONbits.TON = 0;
+        STEPPER_SPEED = 0;
+        STEPPER_TARGET = STEPPER_POSITION;
+        STEPPER_STATE = STEPPER_IDLE;
+        return;
+    }
+    //ramp down over the stopping distance v^2/2a , unless the target is nearer
+    distance = ((unsigned long long) STEPPER_SPEED * STEPPER_SPEED) / ((unsigned long long) STEPPER_ACCEL << 25) + 1;
+    if (STEPPER_TARGET > STEPPER_POSITION) {
+        if (STEPPER_TARGET > STEPPER_POSITION + (long) distance)STEPPER_TARGET = STEPPER_POSITION + distance;
+    } else if (STEPPER_TARGET < STEPPER_POSITION - (long) distance)STEPPER_TARGET = STEPPER_POSITION - distance;
+    _T1IE = 1;
+}
+
+void stepper_tick() {
+    unsigned long remaining;
+    unsigned long long braking;
+    remaining = (STEPPER_TARGET > STEPPER_POSITION) ? STEPPER_TARGET - STEPPER_POSITION : STEPPER_POSITION - STEPPER_TARGET;
+    /* Slow down once the stopping distance v^2/2a reaches the remaining steps. In Q24 that is
+     * v^2 >= 2a*remaining<<24 , and anything past 2^48 is above the top speed squared*/
+    braking = (unsigned long long) remaining * 2 * STEPPER_ACCEL;
+    if (braking < STEPPER_ONE_STEP && (braking << 24) <= (unsigned long long) STEPPER_SPEED * STEPPER_SPEED) {
+        if (STEPPER_SPEED > STEPPER_MIN_SPEED + STEPPER_ACCEL)STEPPER_SPEED -= STEPPER_ACCEL;
+        else STEPPER_SPEED = STEPPER_MIN_SPEED;
+    } else if (STEPPER_SPEED < STEPPER_MAX_SPEED) {
+        STEPPER_SPEED += STEPPER_ACCEL;
+        if (STEPPER_SPEED > STEPPER_MAX_SPEED)STEPPER_SPEED = STEPPER_MAX_SPEED;
+    }
+
+    STEPPER_FRACTION += STEPPER_SPEED;
+    if (STEPPER_FRACTION < STEPPER_ONE_STEP)return;
+    STEPPER_FRACTION -= STEPPER_ONE_STEP;
+    if (STEPPER_TARGET > STEPPER_POSITION) {
+        STEPPER_POSITION++;
+        current_motor_phase = (current_motor_phase + 1)&3;
+    } else {
+        STEPPER_POSITION--;
+        current_motor_phase = (current_motor_phase + 3)&3;
+    }
+    LATC = (LATC & ~0x03C0) | (motor_phases[current_motor_phase] << 6);
+
+    if (STEPPER_POSITION == STEPPER_TARGET) {
+        T1CONbits.TON = 0;
+        _T1IE = 0;
+        STEPPER_SPEED = 0;
+        if (STEPPER_FLAGS & STEPPER_RELEASE)LATC &= ~0x03C0;
+        STEPPER_STATE = STEPPER_IDLE;
+    }
+}
+
 void mapReferenceOscillator(BYTE channel, BYTE scaler) {
     /*--------------External clock monitoring, RP55/RC7  ----------*/
     REFOCONbits.ROON = 0;
@@ -282,6 +494,7 @@ void mapReferenceOscillator(BYTE channel, BYTE scaler) {
 }
 
 void preciseDelay(int t) {
+    stop_frequency_monitor(); //Timer5
     T5CONbits.TON = 0;
     T5CONbits.TCKPS = 2;
     PR5 = t - 1;
@@ -339,6 +552,34 @@ void load_to_flash(_prog_addressT pointer, BYTE location, unsigned int * blk) {
 
 }
 
+void save_wave_preset(BYTE slot, BYTE channel) {
+    /*Store the tables currently played by the channel. The RAM tables are written straight to flash,
+     two words at a time, so the dest[] page copy is not needed*/
+    int *full = (channel == 1) ? sineTable1 : sineTable2;
+    int *sht = (channel == 1) ? sineTable1_short : sineTable2_short;
+    _prog_addressT pointer;
+    uint16 n;
+    _init_prog_address(pointer, wavePresets[0]);
+    pointer += 0x800 * slot;
+    _erase_flash(pointer);
+    for (n = 0; n < WAVE_TABLE_FULL_LENGTH; n += 2, pointer += 4)_write_flash_word32(pointer, full[n], full[n + 1]);
+    for (n = 0; n < WAVE_TABLE_SHORT_LENGTH; n += 2, pointer += 4)_write_flash_word32(pointer, sht[n], sht[n + 1]);
+    _write_flash_word32(pointer, WAVE_PRESET_MAGIC, 0xFFFF);
+}
+
+BYTE recall_wave_preset(BYTE slot, BYTE channel) {
+    /*Copy a stored preset into the channel's tables. DMA and the DDS keep running from the same tables*/
+    _prog_addressT pointer;
+    unsigned int magic;
+    _init_prog_address(pointer, wavePresets[0]);
+    pointer += 0x800 * slot;
+    _memcpy_p2d16(&magic, pointer + 2 * (WAVE_TABLE_FULL_LENGTH + WAVE_TABLE_SHORT_LENGTH), 2);
+    if (magic != WAVE_PRESET_MAGIC)return 0; //empty slot
+    pointer = _memcpy_p2d16((channel == 1) ? sineTable1 : sineTable2, pointer, WAVE_TABLE_FULL_LENGTH * 2);
+    _memcpy_p2d16((channel == 1) ? sineTable1_short : sineTable2_short, pointer, WAVE_TABLE_SHORT_LENGTH * 2);
+    return 1;
+}
+
 void read_flash(_prog_addressT pointer, BYTE location) {
     read_all_from_flash(pointer);
 
@@ -62,6 +62,12 @@ extern _prog_addressT p, pProg;
 
 /*--------Stepper Motor--------*/
 extern BYTE motor_phases[], current_motor_phase;
+extern BYTE STEPPER_STATE;
+extern long STEPPER_POSITION, STEPPER_TARGET;
+extern unsigned long STEPPER_SPEED, STEPPER_MIN_SPEED;
+extern BYTE stepper_move(long target, uint16 speed, uint16 accel, BYTE flags);
+extern void stepper_stop(BYTE halt);
+extern void stepper_tick();
 
 extern BYTE chan;
 extern BYTE data[32];
@@ -69,6 +75,7 @@ extern BYTE cb, cc;
 extern long addr_count;
 
 extern __prog__ unsigned int __attribute__((section("CALIBS"), space(prog), aligned(_FLASH_PAGE * 2))) dat1[15][_FLASH_PAGE];
+extern __prog__ unsigned int __attribute__((section("WAVE_PRESETS"), space(prog), aligned(_FLASH_PAGE * 2))) wavePresets[WAVE_PRESET_SLOTS][_FLASH_PAGE];
 extern void __attribute__((interrupt, no_auto_psv)) _AD1Interrupt(void);
 extern void __attribute__((__interrupt__, no_auto_psv)) _T5Interrupt(void); //For frequency counter
 
@@ -88,6 +95,8 @@ extern void setSensorChannel(char);
 extern void read_all_from_flash(_prog_addressT pointer);
 extern void load_to_flash(_prog_addressT pointer, BYTE location, unsigned int * blk);
 extern void read_flash(_prog_addressT pointer, BYTE location);
+extern void save_wave_preset(BYTE slot, BYTE channel);
+extern BYTE recall_wave_preset(BYTE slot, BYTE channel);
 
 extern void preciseDelay(int t);
 extern void set_CS(BYTE channel,BYTE status);
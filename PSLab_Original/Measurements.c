@@ -2,12 +2,96 @@
 #include "Common_Functions.h"
 #include "PSLAB_ADC.h"
 #include "PSLAB_SPI.h"
+#include "Function.h"
 #include "Measurements.h"
+#include "Wave_Generator.h"
+#include "PSLAB_I2C.h"
 
 BYTE DIN_REMAPS[] ={ID1_REMAP, ID2_REMAP, ID3_REMAP, ID4_REMAP, COMP4_REMAP, RP41_REMAP, FREQ_REMAP};
 BYTE INITIAL_DIGITAL_STATES = 0;
 BYTE LAM1 = 0, LAM2 = 0, LAM3 = 0, LAM4 = 0;
 
+/*-----Logic analyzer trigger engine. Each stage is a pattern (mask/value over ID1-ID4, C4OUT), optionally qualified by an edge----*/
+BYTE LA_TRIGGER_STAGES = 0, LA_TRIGGER_STAGE = 0, LA_TRIGGER_LAST = 0;
+BYTE LA_TRIGGER_MASK[LA_TRIGGER_MAX_STAGES], LA_TRIGGER_VALUE[LA_TRIGGER_MAX_STAGES], LA_TRIGGER_EDGE[LA_TRIGGER_MAX_STAGES];
+uint16 LA_TRIGGER_WINDOW = 0; //Timer2 ticks allowed between stages. 0 => no limit
+
+/*-----Frequency monitor. Every Timer5 gate, the ISR stores the edges counted by Timer2/3 into a ring in ADCbuffer-----*/
+BYTE FREQ_MONITOR_RUNNING = 0, FREQ_MONITOR_OVERRUN = 0;
+uint16 FREQ_MONITOR_SEQ = 0; //sequence number of the reading at FREQ_MONITOR_READ
+uint16 FREQ_MONITOR_READ = 0, FREQ_MONITOR_WRITE = 0;
+unsigned long FREQ_MONITOR_LAST = 0;
+
+/*-----Multi channel frequency. IC1-IC4 share Timer2 and each interrupts after MULTI_FREQ_EDGES edges-----*/
+BYTE MULTI_FREQ_CHANNELS = 0, MULTI_FREQ_DONE = 0; //bit n : IC(n+1) in use / finished
+BYTE MULTI_FREQ_INPUTS[4]; //DIN_REMAPS index assigned to IC1-IC4
+BYTE MULTI_FREQ_STATES = 0; //bit n : level of IC(n+1) input before it was armed
+uint16 MULTI_FREQ_DATA[4][MULTI_FREQ_EDGES];
+
+/*-----Timing histogram. Bins are counted in ADCbuffer-----*/
+unsigned long HISTOGRAM_MIN, HISTOGRAM_MAX, HISTOGRAM_MEAN;
+uint16 HISTOGRAM_COUNT, HISTOGRAM_UNDER, HISTOGRAM_OVER;
+
+/*-----Phase monitor. Each pin 1 edge is paired with the next pin 2 edge, and [delay, period] goes to a ring in ADCbuffer-----*/
+BYTE PHASE_MONITOR_RUNNING = 0, PHASE_MONITOR_OVERRUN = 0;
+BYTE PHASE_MONITOR_PENDING = 0; //1 : waiting for the pin 2 edge. 2 : period of the reference known
+uint16 PHASE_MONITOR_SEQ = 0; //sequence number of the record at PHASE_MONITOR_READ
+uint16 PHASE_MONITOR_READ = 0, PHASE_MONITOR_WRITE = 0;
+unsigned long PHASE_MONITOR_REF = 0, PHASE_MONITOR_PERIOD = 0;
+unsigned long PHASE_MONITOR_MIN, PHASE_MONITOR_MAX, PHASE_MONITOR_COUNT; //delay statistics
+unsigned long long PHASE_MONITOR_DELAY_SUM, PHASE_MONITOR_PERIOD_SUM;
+
+/*-----Background timing jobs. The IC1/IC3 interrupts latch the capture FIFOs, and the host polls for the result-----*/
+BYTE TIMING_JOB = TIMING_JOB_NONE, TIMING_JOB_STATE = 0, TIMING_JOB_FLAGS = 0;
+BYTE TIMING_JOB_PAIRS1 = 0, TIMING_JOB_PAIRS2 = 0;
+uint16 TIMING_JOB_TIMEOUT_TICKS = 0, TIMING_JOB_TMR = 0;
+uint16 TIMING_JOB_DATA[4 * TIMING_JOB_MAX_PAIRS];
+
+/*-----Mixed signal capture. ADC and IC2 both count Timer5 clocks from the same release-----*/
+BYTE MIXED_SIGNAL_TRIGGERED = 0;
+uint16 MIXED_SIGNAL_TMR5 = 0, MIXED_SIGNAL_ICTMR = 0;
+uint16 MIXED_SIGNAL_EDGES = 0, MIXED_SIGNAL_EDGE_LIMIT = 0;
+
+/*-----Timer2 wrap side table for the four channel LA. Entry (index,epoch) : edges from 'index' onwards were captured
+ after 'epoch' wraps of the 16 bit timebase. Timestamp = epoch*65536 + raw. An edge right at a boundary may land on the
+ wrong side of an entry because of interrupt latency, so raw values >= 0x8000 just after an entry belong to epoch-1,
+ and raw values < 0x8000 just before one belong to the entry's epoch-----*/
+BYTE LA_WRAP_TRACKING = 0, LA_WRAP_ENTRIES[4];
+BYTE LA_PROGRESS_TRACKING = 0, LA_BUFFERS_MARKED = 0; //requested by SET_LA_PROGRESS, in effect for this capture
+uint16 LA_WRAPS = 0;
+uint16 LA_SCAN_POS[4]; //last known DMA write index of each capture quarter
+uint16 LA_WRAP_INDEX[4][LA_MAX_WRAP_ENTRIES], LA_WRAP_EPOCH[4][LA_MAX_WRAP_ENTRIES];
+
+BYTE wait_for_discharge(BYTE channel, unsigned int timeout) {
+    /* Converts 'channel' until CAP_SETTLE_SAMPLES readings in a row are below CAP_DISCHARGED, or timeout uS pass.
+     * Leaves the ADC on in CTMU mode. Returns 1 if the node settled*/
+    BYTE settled = 0;
+    stop_frequency_monitor(); //Timer5
+    setADCMode(ADC_CTMU, channel, 0); //manual conversions : clearing SAMP starts one
+    AD1CON1bits.ADON = 1;
+    Delay_us(20);
+    T5CONbits.TON = 0;
+    T5CONbits.TGATE = 0;
+    T5CONbits.TCKPS = 2; //1uS
+    PR5 = timeout;
+    TMR5 = 0x0000;
+    _T5IF = 0;
+    T5CONbits.TON = 1;
+    while (!_T5IF) {
+        AD1CON1bits.SAMP = 1;
+        Delay_us(1);
+        AD1CON1bits.DONE = 0;
+        AD1CON1bits.SAMP = 0;
+        while (!AD1CON1bits.DONE);
+        if ((ADC1BUF0 & 0xFFF) < CAP_DISCHARGED) {
+            if (++settled >= CAP_SETTLE_SAMPLES)break;
+        } else settled = 0;
+    }
+    T5CONbits.TON = 0;
+    _T5IF = 0;
+    return settled >= CAP_SETTLE_SAMPLES;
+}
+
 void set_cap_voltage(BYTE v, unsigned int time) {
     _TRISC0 = 0;
     _ANSC0 = 0;
@@ -24,8 +108,21 @@ void set_cap_voltage(BYTE v, unsigned int time) {
 
 }
 
+void discharge_cap(unsigned int timeout) {
+    /* set_cap_voltage(0,timeout) for the capacitance routines. Stops as soon as the CAP channel reads empty, but
+     * leaves the ADC in CTMU mode and Timer5 stopped, so SET_CAP keeps the plain delay*/
+    _TRISC0 = 0;
+    _ANSC0 = 0;
+    _LATC0 = 0;
+    wait_for_discharge(5, timeout);
+    _TRISC0 = 1;
+    _ANSC0 = 1;
+    Nop(); //Return C0 to high impedance
+}
+
 unsigned int get_cc_capacitance(BYTE current_range, BYTE trimval, unsigned int ChargeTime) {
     unsigned int sum = 0;
+    discharge_cap(50000); //also leaves the ADC in CTMU mode on the CAP channel
     setADCMode(ADC_CTMU, 5, 0); // 5 is the CAP channel
     CTMUCON1bits.TGEN = 1;
     CTMUICONbits.ITRIM = trimval;
@@ -33,15 +130,13 @@ unsigned int get_cc_capacitance(BYTE current_range, BYTE trimval, unsigned int C
     T5CONbits.TON = 0;
     T5CONbits.TGATE = 0;
     T5CONbits.TCKPS = 2;
-    PR5 = ChargeTime;
-    set_cap_voltage(0, 50000);
     AD1CON1bits.ADON = 1;
-    Delay_us(20);
-    AD1CON1bits.SAMP = 1; //start sampling
     CTMUCON1bits.CTMUEN = 1;
-    Delay_us(1000);
+    Delay_us(CTMU_STARTUP_US);
     CTMUCON1bits.IDISSEN = 1; //Ground the charge PUMP
-    Delay_us(1500); //Grounding the ADC S&H
+    wait_for_discharge(5, CTMU_SETTLE_TIMEOUT); //Grounding the ADC S&H
+    PR5 = ChargeTime;
+    AD1CON1bits.SAMP = 1; //start sampling
 
     TMR5 = 0x0000;
     _T5IF = 0;
@@ -74,8 +169,8 @@ void disableCTMUSource() {
 
 unsigned int get_cap_range(unsigned int time) {
     unsigned int sum = 0;
-    set_cap_voltage(0, 50000);
-    set_cap_voltage(0, 50000);
+    discharge_cap(50000);
+    discharge_cap(50000);
     setADCMode(ADC_12BIT_AVERAGING, 5, 0);
     T5CONbits.TON = 0;
     TMR5 = 0x0000;
@@ -93,6 +188,74 @@ unsigned int get_cap_range(unsigned int time) {
     return sum;
 }
 
+BYTE get_capacitance_autorange(BYTE trimval, BYTE *current_range, unsigned int *ChargeTime, unsigned int *reading) {
+    /* Probes with 0.53uA for 1mS, then scales the charge time linearly towards CAP_TARGET.
+     * Moves one current range up or down whenever the charge time leaves [CAP_MIN_CHARGE, CAP_MAX_CHARGE].
+     * Returns the number of attempts, or 0 if the reading never landed in the window*/
+    BYTE ranges[] = {1, 2, 3, 0}; // .53uA, 5.3uA, 53uA, 530uA
+    BYTE range = 0, attempt;
+    unsigned long t = 1000;
+    unsigned int v = 0;
+
+    for (attempt = 1; attempt <= CAP_MAX_ATTEMPTS; attempt++) {
+        v = get_cc_capacitance(ranges[range], trimval, t);
+        *current_range = ranges[range];
+        *ChargeTime = t;
+        *reading = v;
+        if (v >= CAP_WINDOW_LOW && v <= CAP_WINDOW_HIGH)return attempt;
+
+        if (v >= CAP_SATURATED)t /= 8; //not linear any more. Back off hard
+        else if (v < CAP_TARGET / 64)t *= 64;
+        else t = t * CAP_TARGET / v;
+
+        if (t > CAP_MAX_CHARGE) {
+            if (range == sizeof (ranges) - 1)t = CAP_MAX_CHARGE;
+            else {
+                range++;
+                t /= 10;
+            }
+        } else if (t < CAP_MIN_CHARGE) {
+            if (range == 0)t = CAP_MIN_CHARGE;
+            else {
+                range--;
+                t *= 10;
+            }
+        }
+        if (t > CAP_MAX_CHARGE)t = CAP_MAX_CHARGE;
+        if (t < CAP_MIN_CHARGE)t = CAP_MIN_CHARGE;
+        if (t == *ChargeTime && ranges[range] == *current_range)return 0; //pinned at a limit
+    }
+    return 0;
+}
+
+void ctmu_sweep(BYTE channel, BYTE tgen, int *steps, uint16 count, int *readings) {
+    /* get_ctmu_voltage for each [IRNG | ITRIM] step. The CTMU stays enabled across steps,
+     * and the current source warm up is only repeated when IRNG changes*/
+    uint16 n;
+    BYTE range = 0xFF;
+    CTMUCON1bits.TGEN = tgen;
+    CTMUCON2bits.EDG1STAT = 0;
+    CTMUCON1bits.CTTRIG = 0; //do not trigger the ADC
+    if (channel != 30)CTMUCON2bits.EDG2STAT = 0;
+    else CTMUCON2bits.EDG2STAT = 1; //30 -> internal temperature.
+    CTMUCON1bits.CTMUSIDL = 0;
+    for (n = 0; n < count; n++) {
+        CTMUCON2bits.EDG1STAT = 0; // Stop current source
+        CTMUICONbits.ITRIM = steps[n] & 0x3F;
+        CTMUICONbits.IRNG = (steps[n] >> 6)&0x3;
+        CTMUCON1bits.CTMUEN = 1;
+        if (range != ((steps[n] >> 6)&0x3))Delay_us(CTMU_STARTUP_US);
+        range = (steps[n] >> 6)&0x3;
+        CTMUCON1bits.IDISSEN = 1; //Ground the charge PUMP
+        wait_for_discharge(channel, CTMU_SETTLE_TIMEOUT);
+        AD1CON1bits.ADON = 0;
+        CTMUCON1bits.IDISSEN = 0; //stop draining the circuit
+        CTMUCON2bits.EDG1STAT = 1; // Start current source
+        readings[n] = get_voltage_summed(channel);
+    }
+    disableCTMUSource();
+}
+
 unsigned int get_ctmu_voltage(BYTE channel, BYTE range, BYTE tgen) {
     unsigned int temp = 0;
     CTMUCON1bits.TGEN = tgen; //(channel==5)?1:0;
@@ -103,10 +266,11 @@ unsigned int get_ctmu_voltage(BYTE channel, BYTE range, BYTE tgen) {
     if (channel != 30)CTMUCON2bits.EDG2STAT = 0;
     else CTMUCON2bits.EDG2STAT = 1; //30 -> internal temperature.
     CTMUCON1bits.CTMUEN = 1;
-    Delay_us(1000);
+    Delay_us(CTMU_STARTUP_US);
 
     CTMUCON1bits.IDISSEN = 1; //Ground the charge PUMP
-    Delay_us(1500); //Grounding the ADC S&H
+    wait_for_discharge(channel, CTMU_SETTLE_TIMEOUT); //Grounding the ADC S&H
+    AD1CON1bits.ADON = 0;
     CTMUCON1bits.IDISSEN = 0; //stop draining the circuit
 
     CTMUCON1bits.CTMUSIDL = 0; //0=enable operation in idle mode
@@ -166,6 +330,10 @@ unsigned int get_ctmu_voltage(BYTE channel, BYTE range, BYTE tgen) {
 }
 
 void get_high_frequency(BYTE channel, BYTE scale) { //T2CK is tied to ID1. Using timer 3/2
+    stop_dac_stream(); //Timer2
+    stop_frequency_monitor(); //Timer2/3 and Timer5. start_frequency_monitor restarts it afterwards
+    stop_phase_monitor();
+    cancel_timing_job(); //TimingMeasurements jobs count on Timer2
 
     if (channel == 4) EnableComparator();
     RPINR3bits.T2CKR = DIN_REMAPS[channel];
@@ -174,6 +342,7 @@ void get_high_frequency(BYTE channel, BYTE scale) { //T2CK is tied to ID1. Using
     T2CONbits.TON = 0; // Stop any 16/32-bit Timer2 operation
     T5CONbits.TON = 0; // Stop any 16/32-bit Timer5 operation
 
+    if (DDS_ACTIVE2)stopDDS(2); //Timer3 is about to become the counter's msw
     T2CONbits.T32 = 1; // 32 bit mode T2 and T3
     T2CONbits.TCS = 1; // Select External clock
     T2CONbits.TCKPS = scale; // Select Prescaler
@@ -194,7 +363,625 @@ void get_high_frequency(BYTE channel, BYTE scale) { //T2CK is tied to ID1. Using
 
 }
 
+void start_frequency_monitor(BYTE channel, BYTE scale, uint16 gate) {
+    /* Same counter setup as get_high_frequency, but Timer2/3 free-run and Timer5 interrupts at every gate.
+     * Readings are differences of the running count, so no edges are lost between gates*/
+    get_high_frequency(channel, scale);
+    T5CONbits.TON = 0;
+    PR5 = gate; //Timer5 ticks at 1:256 (4uS)
+    TMR5 = 0x0000;
+    FREQ_MONITOR_READ = 0;
+    FREQ_MONITOR_WRITE = 0;
+    FREQ_MONITOR_SEQ = 0;
+    FREQ_MONITOR_OVERRUN = 0;
+    FREQ_MONITOR_LAST = 0;
+    FREQ_MONITOR_RUNNING = 1;
+    _T5IP = 0x01;
+    _T5IF = 0;
+    _T5IE = 1;
+    T5CONbits.TON = 1;
+}
+
+void stop_frequency_monitor() {
+    if (!FREQ_MONITOR_RUNNING)return; //Timer2 may belong to someone else
+    _T5IE = 0;
+    _T5IF = 0;
+    T5CONbits.TON = 0;
+    T2CONbits.TON = 0;
+    FREQ_MONITOR_RUNNING = 0;
+}
+
+void frequency_monitor_sample() {
+    unsigned long count;
+    uint16 next;
+    count = TMR2; //reading TMR2 latches TMR3 into TMR3HLD
+    count |= (unsigned long) TMR3HLD << 16;
+    ADCbuffer[2 * FREQ_MONITOR_WRITE] = (count - FREQ_MONITOR_LAST) & 0xFFFF;
+    ADCbuffer[2 * FREQ_MONITOR_WRITE + 1] = ((count - FREQ_MONITOR_LAST) >> 16) & 0xFFFF;
+    FREQ_MONITOR_LAST = count;
+    next = FREQ_MONITOR_WRITE + 1;
+    if (next == FREQ_MONITOR_LENGTH)next = 0;
+    if (next == FREQ_MONITOR_READ) { //host fell behind. Drop the oldest reading
+        FREQ_MONITOR_READ++;
+        if (FREQ_MONITOR_READ == FREQ_MONITOR_LENGTH)FREQ_MONITOR_READ = 0;
+        FREQ_MONITOR_SEQ++;
+        FREQ_MONITOR_OVERRUN = 1;
+    }
+    FREQ_MONITOR_WRITE = next;
+}
+
+void start_multi_frequency(BYTE count, BYTE scale) {
+    BYTE n, states;
+    stop_dac_stream(); //Timer2 is the timebase here
+    stop_frequency_monitor();
+    stop_phase_monitor(); //IC1-IC4
+    cancel_timing_job();
+    disable_input_capture();
+    _IC1IE = 0;
+    _IC2IE = 0;
+    _IC3IE = 0;
+    _IC4IE = 0;
+    MULTI_FREQ_CHANNELS = (1 << count) - 1;
+    MULTI_FREQ_DONE = 0;
+    for (n = 0; n < count; n++)if (MULTI_FREQ_INPUTS[n] == 4)EnableComparator();
+
+    RPINR7bits.IC1R = DIN_REMAPS[MULTI_FREQ_INPUTS[0]];
+    if (count > 1)RPINR7bits.IC2R = DIN_REMAPS[MULTI_FREQ_INPUTS[1]];
+    if (count > 2)RPINR8bits.IC3R = DIN_REMAPS[MULTI_FREQ_INPUTS[2]];
+    if (count > 3)RPINR8bits.IC4R = DIN_REMAPS[MULTI_FREQ_INPUTS[3]];
+
+    T2CONbits.TON = 0;
+    T2CONbits.T32 = 0;
+    T2CONbits.TCS = 0; //internal clock
+    T2CONbits.TCKPS = scale & 0x3;
+    PR2 = 0xFFFF;
+    TMR2 = 0x0000;
+
+    IC1CON1bits.ICTSEL = 0b1;
+    IC2CON1bits.ICTSEL = 0b1;
+    IC3CON1bits.ICTSEL = 0b1;
+    IC4CON1bits.ICTSEL = 0b1; //TIMER2
+    IC1CON1bits.ICI = MULTI_FREQ_EDGES - 1;
+    IC2CON1bits.ICI = MULTI_FREQ_EDGES - 1;
+    IC3CON1bits.ICI = MULTI_FREQ_EDGES - 1;
+    IC4CON1bits.ICI = MULTI_FREQ_EDGES - 1; //interrupt once the FIFO holds every edge
+    IC1CON2bits.IC32 = 0;
+    IC2CON2bits.IC32 = 0;
+    IC3CON2bits.IC32 = 0;
+    IC4CON2bits.IC32 = 0;
+    IC1CON2bits.SYNCSEL = 0;
+    IC2CON2bits.SYNCSEL = 0;
+    IC3CON2bits.SYNCSEL = 0;
+    IC4CON2bits.SYNCSEL = 0;
+    IC1CON2bits.ICTRIG = 1;
+    IC2CON2bits.ICTRIG = 1;
+    IC3CON2bits.ICTRIG = 1;
+    IC4CON2bits.ICTRIG = 1;
+
+    _IC1IF = 0;
+    _IC2IF = 0;
+    _IC3IF = 0;
+    _IC4IF = 0;
+    _IC1IP = 1;
+    _IC2IP = 1;
+    _IC3IP = 1;
+    _IC4IP = 1;
+    //the first edge's polarity is taken from the levels just before arming, as for INITIAL_DIGITAL_STATES
+    states = ((PORTB >> 10)&0xF) | (_C4OUT << 4);
+    MULTI_FREQ_STATES = 0;
+    for (n = 0; n < count; n++)if ((states >> MULTI_FREQ_INPUTS[n])&1)MULTI_FREQ_STATES |= 1 << n;
+    IC1CON1bits.ICM = EVERY_EDGE;
+    if (count > 1)IC2CON1bits.ICM = EVERY_EDGE;
+    if (count > 2)IC3CON1bits.ICM = EVERY_EDGE;
+    if (count > 3)IC4CON1bits.ICM = EVERY_EDGE;
+    _IC1IE = 1;
+    _IC2IE = (count > 1);
+    _IC3IE = (count > 2);
+    _IC4IE = (count > 3);
+    IC1CON2bits.TRIGSTAT = 1;
+    IC2CON2bits.TRIGSTAT = 1;
+    IC3CON2bits.TRIGSTAT = 1;
+    IC4CON2bits.TRIGSTAT = 1;
+    T2CONbits.TON = 1;
+}
+
+void multi_frequency_latch(BYTE module) {
+    BYTE n;
+    uint16 *dest = &MULTI_FREQ_DATA[module][0];
+    if (module == 0) {
+        _IC1IE = 0;
+        for (n = 0; n < MULTI_FREQ_EDGES; n++)*dest++ = IC1BUF;
+        IC1CON1bits.ICM = 0;
+    } else if (module == 1) {
+        _IC2IE = 0;
+        for (n = 0; n < MULTI_FREQ_EDGES; n++)*dest++ = IC2BUF;
+        IC2CON1bits.ICM = 0;
+    } else if (module == 2) {
+        _IC3IE = 0;
+        for (n = 0; n < MULTI_FREQ_EDGES; n++)*dest++ = IC3BUF;
+        IC3CON1bits.ICM = 0;
+    } else {
+        _IC4IE = 0;
+        for (n = 0; n < MULTI_FREQ_EDGES; n++)*dest++ = IC4BUF;
+        IC4CON1bits.ICM = 0;
+    }
+    MULTI_FREQ_DONE |= 1 << module;
+}
+
+void stop_multi_frequency() {
+    _IC1IE = 0;
+    _IC2IE = 0;
+    _IC3IE = 0;
+    _IC4IE = 0;
+    MULTI_FREQ_CHANNELS = 0;
+    T2CONbits.TON = 0;
+    RPINR7bits.IC1R = 0;
+    RPINR7bits.IC2R = 0;
+    RPINR8bits.IC3R = 0;
+    RPINR8bits.IC4R = 0; //disconnect
+    disable_input_capture();
+}
+
+BYTE timing_histogram(BYTE channel, BYTE mode, uint16 samples, unsigned long origin, BYTE shift, uint16 bins, uint16 timeout) {
+    /* Bins values of (interval-origin)>>shift, with intervals in Fp ticks from the 32 bit IC1/IC2 pair.
+     * Returns 1 on timeout or capture overflow*/
+    unsigned long long sum = 0;
+    unsigned long now, last = 0, interval;
+    uint16 n, rollovers = 0, bin;
+    BYTE level, have_last = 0;
+
+    for (n = 0; n < bins; n++)ADCbuffer[n] = 0;
+    HISTOGRAM_MIN = 0xFFFFFFFF;
+    HISTOGRAM_MAX = 0;
+    HISTOGRAM_COUNT = 0;
+    HISTOGRAM_UNDER = 0;
+    HISTOGRAM_OVER = 0;
+
+    stop_frequency_monitor(); //Timer5, and its readings live in ADCbuffer
+    T5CONbits.TON = 0;
+    T5CONbits.TCKPS = 3; //1:256 , 4uS
+    PR5 = 0xFFFF;
+    TMR5 = 0;
+    _T5IF = 0;
+    T5CONbits.TON = 1;
+
+    level = (((PORTB >> 10)&0xF) | (_C4OUT << 4)) >> channel & 1; //level before the first edge
+    init_IC_for_frequency(channel, mode == HISTOGRAM_PERIOD ? EVERY_RISING_EDGE : EVERY_EDGE, 1);
+
+    while (HISTOGRAM_COUNT < samples) {
+        asm("CLRWDT"); //the timeout can outlast the watchdog
+        if (_T5IF) {
+            _T5IF = 0;
+            if (++rollovers >= timeout)break;
+        }
+        if (!IC1CON1bits.ICBNE)continue;
+        now = IC1BUF;
+        now |= (unsigned long) IC2BUF << 16;
+        if (mode != HISTOGRAM_PERIOD)level ^= 1; //level after this edge
+        interval = now - last;
+        last = now;
+        if (!have_last) {
+            have_last = 1;
+            continue;
+        }
+        if (mode == HISTOGRAM_HIGH && level)continue; //the interval ending on a rising edge was low
+        if (mode == HISTOGRAM_LOW && !level)continue;
+
+        if (interval < HISTOGRAM_MIN)HISTOGRAM_MIN = interval;
+        if (interval > HISTOGRAM_MAX)HISTOGRAM_MAX = interval;
+        sum += interval;
+        HISTOGRAM_COUNT++;
+        if (interval < origin)HISTOGRAM_UNDER++;
+        else if (((interval - origin) >> shift) >= bins)HISTOGRAM_OVER++;
+        else {
+            bin = (interval - origin) >> shift;
+            if (ADCbuffer[bin] != -1)ADCbuffer[bin]++; //saturate at 65535
+        }
+    }
+
+    n = IC1CON1bits.ICOV || IC2CON1bits.ICOV;
+    T5CONbits.TON = 0;
+    _T5IF = 0;
+    RPINR7bits.IC1R = 0; //disconnect
+    disable_input_capture();
+    HISTOGRAM_MEAN = HISTOGRAM_COUNT ? sum / HISTOGRAM_COUNT : 0;
+    return (HISTOGRAM_COUNT < samples) || n;
+}
+
+void start_phase_monitor(BYTE pin1, BYTE pin2, BYTE pin1_edge, BYTE pin2_edge) {
+    //Both 32 bit capture pairs run from Timer2 at Fp, as in TimingMeasurements
+    stop_frequency_monitor(); //Timer2
+    TimingMeasurements(pin1, pin2, pin1_edge, pin2_edge, 1, 1); //also ends a running phase monitor or timing job
+    PHASE_MONITOR_READ = 0;
+    PHASE_MONITOR_WRITE = 0;
+    PHASE_MONITOR_SEQ = 0;
+    PHASE_MONITOR_OVERRUN = 0;
+    PHASE_MONITOR_PENDING = 0;
+    PHASE_MONITOR_MIN = 0xFFFFFFFF;
+    PHASE_MONITOR_MAX = 0;
+    PHASE_MONITOR_COUNT = 0;
+    PHASE_MONITOR_DELAY_SUM = 0;
+    PHASE_MONITOR_PERIOD_SUM = 0;
+    PHASE_MONITOR_RUNNING = 1;
+    _IC1IP = 1;
+    _IC3IP = 1; //same priority, so the two latches never interrupt each other
+    _IC1IE = 1;
+    _IC3IE = 1;
+}
+
+void stop_phase_monitor() {
+    if (!PHASE_MONITOR_RUNNING)return; //IC1/IC3 and Timer2 may belong to someone else
+    _IC1IE = 0;
+    _IC3IE = 0;
+    PHASE_MONITOR_RUNNING = 0;
+    RPINR7bits.IC1R = 0;
+    RPINR8bits.IC3R = 0; //disconnect
+    disable_input_capture();
+    T2CONbits.TON = 0;
+}
+
+void phase_monitor_latch(BYTE pin) {
+    unsigned long t, delay;
+    uint16 next;
+    if (pin == 1) {
+        t = IC1BUF;
+        t |= (unsigned long) IC2BUF << 16;
+        if (PHASE_MONITOR_PENDING & 2)PHASE_MONITOR_PERIOD = t - PHASE_MONITOR_REF;
+        PHASE_MONITOR_REF = t;
+        PHASE_MONITOR_PENDING = (PHASE_MONITOR_PENDING & 2) ? 3 : 2;
+        if (PHASE_MONITOR_PERIOD == 0)PHASE_MONITOR_PENDING = 2; //no full cycle yet
+        return;
+    }
+    t = IC3BUF;
+    t |= (unsigned long) IC4BUF << 16;
+    if (PHASE_MONITOR_PENDING != 3)return;
+    PHASE_MONITOR_PENDING = 2;
+    delay = t - PHASE_MONITOR_REF;
+
+    ADCbuffer[4 * PHASE_MONITOR_WRITE] = delay & 0xFFFF;
+    ADCbuffer[4 * PHASE_MONITOR_WRITE + 1] = (delay >> 16) & 0xFFFF;
+    ADCbuffer[4 * PHASE_MONITOR_WRITE + 2] = PHASE_MONITOR_PERIOD & 0xFFFF;
+    ADCbuffer[4 * PHASE_MONITOR_WRITE + 3] = (PHASE_MONITOR_PERIOD >> 16) & 0xFFFF;
+    next = PHASE_MONITOR_WRITE + 1;
+    if (next == PHASE_MONITOR_LENGTH)next = 0;
+    if (next == PHASE_MONITOR_READ) { //host fell behind. Drop the oldest record
+        PHASE_MONITOR_READ++;
+        if (PHASE_MONITOR_READ == PHASE_MONITOR_LENGTH)PHASE_MONITOR_READ = 0;
+        PHASE_MONITOR_SEQ++;
+        PHASE_MONITOR_OVERRUN = 1;
+    }
+    PHASE_MONITOR_WRITE = next;
+
+    if (delay < PHASE_MONITOR_MIN)PHASE_MONITOR_MIN = delay;
+    if (delay > PHASE_MONITOR_MAX)PHASE_MONITOR_MAX = delay;
+    PHASE_MONITOR_DELAY_SUM += delay;
+    PHASE_MONITOR_PERIOD_SUM += PHASE_MONITOR_PERIOD;
+    PHASE_MONITOR_COUNT++;
+}
+
+uint16 phase_of(unsigned long delay, unsigned long period) { //fraction of a cycle, 65536 = 360 degrees
+    unsigned long long phase;
+    if (period == 0)return 0;
+    phase = ((unsigned long long) delay << 16) / period;
+    return phase > 0xFFFF ? 0xFFFF : phase;
+}
+
+long log2_q12(uint16 x) { //x > 0. log2(1+f) ~ f + 0.3465*f*(1-f) , within 0.01
+    BYTE e = 15;
+    long f;
+    while (!(x & 0x8000)) {
+        x <<= 1;
+        e--;
+    }
+    f = x & 0x7FFF; //Q15 mantissa fraction
+    f += ((f * (32768 - f)) >> 15) * 355 >> 10;
+    return ((long) e << 12) + (f >> 3);
+}
+
+long exp2_q12(long a) { //2^(a/4096) , a >= 0. 2^f ~ 1 + f*(0.6565 + 0.3435*f)
+    long f = a & 0xFFF, t;
+    t = 4096 + ((f * (2689 + ((1407 * f) >> 12))) >> 12);
+    return (t << (a >> 12)) >> 12;
+}
+
+BYTE fit_rc_curve(uint16 start, uint16 count, uint16 full_scale, uint16 vinf_override, unsigned long *tau, uint16 *v0, uint16 *vinf, uint16 *residual, uint16 *used) {
+    /* Fits v = Vinf + (V0-Vinf)*exp(-t/tau) to ADCbuffer[start:start+count] as a line through log2|v-Vinf|.
+     * Vinf is the mean of the last eighth of the curve unless the host supplies it (vinf_override != 0xFFFF).
+     * tau is in samples, Q8. The residual is the mean log2 error in Q12*/
+    long long n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, num, den, err = 0;
+    long m, a, y;
+    uint16 i, v, d, tail;
+    BYTE rising;
+
+    if (vinf_override != 0xFFFF)*vinf = vinf_override;
+    else {
+        tail = count / 8;
+        if (!tail)tail = 1;
+        for (i = count - tail, a = 0; i < count; i++)a += ADCbuffer[start + i];
+        *vinf = a / tail;
+    }
+    rising = ADCbuffer[start] < *vinf;
+
+    for (i = 0; i < count; i++) {
+        v = ADCbuffer[start + i];
+        if (v <= FIT_SATURATION_MARGIN || v >= full_scale - FIT_SATURATION_MARGIN)continue;
+        d = v > *vinf ? v - *vinf : *vinf - v;
+        if (d < FIT_BASELINE)continue;
+        y = log2_q12(d);
+        n++;
+        sx += i;
+        sy += y;
+        sxx += (long) i * i;
+        sxy += (long long) i * y;
+    }
+    *used = n;
+    if (n < FIT_MIN_POINTS)return FIT_TOO_FEW;
+    num = n * sxy - sx * sy;
+    den = n * sxx - sx * sx;
+    if (num >= 0 || den <= 0)return FIT_NOT_DECAYING;
+    num = -num;
+    while (num > (1LL << 40) || den > (1LL << 40)) {
+        num >>= 1;
+        den >>= 1;
+    }
+    if (!num)return FIT_NOT_DECAYING;
+    *tau = (5909LL * 256 * den) / num; //log2(e)*4096 * 256 / slope
+    m = -((num << 12) / den); //slope. Q24 log2 per sample
+    a = (sy - (((long long) m * sx) >> 12)) / n; //intercept. Q12
+    if (a < 0)a = 0;
+    d = exp2_q12(a);
+    *v0 = rising ? *vinf - d : *vinf + d;
+
+    for (i = 0; i < count; i++) {
+        v = ADCbuffer[start + i];
+        if (v <= FIT_SATURATION_MARGIN || v >= full_scale - FIT_SATURATION_MARGIN)continue;
+        d = v > *vinf ? v - *vinf : *vinf - v;
+        if (d < FIT_BASELINE)continue;
+        y = log2_q12(d) - a - (((long long) m * i) >> 12);
+        err += y < 0 ? -y : y;
+    }
+    *residual = err / n;
+    return FIT_OK;
+}
+
+BYTE get_echo_delay(uint16 samples, uint16 burst, uint16 first_lag, uint16 last_lag, long *lag, uint16 *score) {
+    /* Cross correlates the PULSE_TRAIN capture in ADCbuffer[0:samples] against the emitted burst.
+     * The +1/-1 template is rebuilt from the SQR1 (Timer1/OC1) settings, 'burst' uS long, at the
+     * ADC_DELAY sample rate, and stored after the capture. lag is in samples, Q8. score is Q15*/
+    const uint16 prescalers[] = {1, 8, 64, 256};
+    unsigned long period, high, step, phase = 0;
+    uint16 length, k, n, best = 0;
+    long mean = 0, c, best_c = 0, prev_c = 0, next_c = 0, c_prev = 0, norm = 0, templ_sum = 0, num, den;
+    int *templ = &ADCbuffer[samples];
+
+    period = ((unsigned long) PR1 + 1) * prescalers[T1CONbits.TCKPS]; //Fcy ticks
+    high = ((unsigned long) OC1R + 1) * prescalers[T1CONbits.TCKPS];
+    step = (unsigned long) ADC_DELAY * 8; //Timer5 at 1:8 paces the ADC
+    length = ((unsigned long) burst * 64) / step;
+    if (!length || samples + length > BUFFER_SIZE || length > samples)return ECHO_NO_ROOM;
+    for (k = 0; k < length; k++) {
+        templ[k] = phase < high ? 1 : -1;
+        templ_sum += templ[k];
+        phase += step;
+        while (phase >= period)phase -= period;
+    }
+
+    if (last_lag == 0 || last_lag > samples - length)last_lag = samples - length;
+    if (first_lag > last_lag)return ECHO_NO_PEAK;
+    for (k = 0; k < samples; k++)mean += ADCbuffer[k];
+    mean /= samples;
+
+    for (n = first_lag; n <= last_lag; n++) {
+        asm("CLRWDT"); //a full buffer is millions of additions
+        c = -mean * templ_sum;
+        for (k = 0; k < length; k++) {
+            if (templ[k] > 0)c += ADCbuffer[n + k];
+            else c -= ADCbuffer[n + k];
+        }
+        if (n == first_lag || c > best_c) {
+            best_c = c;
+            best = n;
+            prev_c = c_prev;
+            next_c = c;
+        } else if (n == best + 1)next_c = c;
+        c_prev = c;
+    }
+    if (best_c <= 0)return ECHO_NO_PEAK;
+
+    *lag = (long) best << 8;
+    if (best > first_lag && best < last_lag) { //parabolic peak interpolation
+        den = 2 * (prev_c - 2 * best_c + next_c);
+        num = prev_c - next_c;
+        if (den < 0)*lag += (num * 256) / den;
+    }
+    for (k = 0; k < length; k++) {
+        c = ADCbuffer[best + k] - mean;
+        norm += c < 0 ? -c : c;
+    }
+    num = norm ? ((long long) best_c << 15) / norm : 0;
+    *score = num > 32767 ? 32767 : num;
+    return ECHO_OK;
+}
+
+const int quarter_sine[] = {//Q15, 64 steps per quarter cycle
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757, 32767
+};
+const int cordic_angles[] = {8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1}; //atan(2^-i), 65536 = 360 degrees
+
+int sin_q15(BYTE index) { //256 steps per cycle
+    BYTE r = index & 63;
+    switch (index >> 6) {
+        case 0: return quarter_sine[r];
+        case 1: return quarter_sine[64 - r];
+        case 2: return -quarter_sine[r];
+        default: return -quarter_sine[64 - r];
+    }
+}
+
+uint16 cordic_vector(long x, long y, unsigned long *magnitude) { //atan2(y,x), 65536 = 360 degrees. magnitude *1.647
+    uint16 angle = 0;
+    long t;
+    BYTE i;
+    if (x < 0) {
+        x = -x;
+        y = -y;
+        angle = 32768;
+    }
+    for (i = 0; i < sizeof (cordic_angles) / sizeof (int); i++) {
+        t = x;
+        if (y > 0) {
+            x += y >> i;
+            y -= t >> i;
+            angle += cordic_angles[i];
+        } else {
+            x -= y >> i;
+            y += t >> i;
+            angle -= cordic_angles[i];
+        }
+    }
+    *magnitude = x;
+    return angle;
+}
+
+BYTE bode_point(BYTE channel, unsigned long tuning, uint16 cycles, uint16 settle, uint16 max_samples, uint16 *gain, int *phase) {
+    /* Retunes the DDS on sine 1, waits 'settle' stimulus cycles, then captures 'channel' (CH0) and CH1 together
+     * at BODE_SAMPLES_PER_CYCLE. Both are I/Q demodulated over whole stimulus cycles against the same reference.
+     * gain = |CH0|/|CH1| in Q12, phase = CH0 - CH1 in 1/65536 of a cycle. Returns 1 if nothing could be measured*/
+    unsigned long p, dphi, delay, mag[2], limit;
+    uint16 n, used = 0, c, top, last_top;
+    long long acc_i, acc_q;
+    long mean;
+    int x, *data;
+    uint16 angle[2];
+
+    _T4IE = 0;
+    DDS_TUNING1 = tuning; //phase continuous
+    _T4IE = 1;
+    last_top = DDS_PHASE1 >> 16; //16 bit read. Safe against the ISR
+    acc_i = (((unsigned long long) settle * 40) << 32) / tuning + 1000; //uS. Twice the 20uS/sample settling time
+    limit = acc_i > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : acc_i;
+    while (settle) {
+        top = DDS_PHASE1 >> 16;
+        if (top < last_top)settle--; //accumulator wrapped : one stimulus cycle
+        last_top = top;
+        if (!limit--)return 1; //the DDS is not running
+        Delay_us(1);
+        asm("CLRWDT");
+    }
+
+    delay = (160ULL << 32) / ((unsigned long long) BODE_SAMPLES_PER_CYCLE * tuning); //Timer5 ticks per sample. Fcy/8 over DDS rate = 160
+    if (delay < BODE_MIN_DELAY)delay = BODE_MIN_DELAY;
+    if (delay > 0xFFFF)delay = 0xFFFF;
+    ADC_DELAY = delay;
+    acc_i = ((160ULL << 32) * cycles) / ((unsigned long long) delay * tuning) + 1;
+    samples_to_fetch = acc_i > max_samples ? max_samples : acc_i;
+
+    ADC_CHANNELS = 1; //capture two channels. As CAPTURE_TWO, untriggered
+    AD1CON2bits.CHPS = 1;
+    setADCMode(ADC_10BIT_SIMULTANEOUS, channel, 0);
+    AD1CON2bits.CHPS = 1;
+    buff0 = &ADCbuffer[0];
+    buff1 = &ADCbuffer[samples_to_fetch];
+    endbuff = &ADCbuffer[samples_to_fetch];
+    TRIGGERED = TRUE;
+    conversion_done = 0;
+    samples = 0;
+    setupADC10();
+    _AD1IF = 0;
+    _AD1IE = 1;
+    limit = ((unsigned long) samples_to_fetch * delay) / 4 + 1000; //uS. Twice the capture time at 8 ticks/uS
+    while (!conversion_done) {
+        if (!limit--) {
+            _AD1IE = 0;
+            T5CONbits.TON = 0;
+            return 1;
+        }
+        Delay_us(1);
+        asm("CLRWDT");
+    }
+
+    dphi = ((unsigned long long) tuning * delay * 8) / DDS_SAMPLE_TICKS; //reference phase step per sample
+    for (n = 0, p = 0; n < samples_to_fetch; n++) {
+        if (p + dphi < p)used = n + 1; //last sample of a whole cycle
+        p += dphi;
+    }
+    if (!used)return 1;
+
+    for (c = 0; c < 2; c++) {
+        data = &ADCbuffer[c * samples_to_fetch];
+        for (n = 0, mean = 0; n < used; n++)mean += data[n];
+        mean /= used;
+        acc_i = 0;
+        acc_q = 0;
+        for (n = 0, p = 0; n < used; n++, p += dphi) {
+            x = data[n] - mean;
+            acc_i += (long) x * sin_q15((p >> 24) + 64);
+            acc_q += (long) x * sin_q15(p >> 24);
+        }
+        angle[c] = cordic_vector(acc_i >> 15, acc_q >> 15, &mag[c]);
+    }
+    if (!mag[1])return 1;
+    p = (mag[0] << 12) / mag[1];
+    *gain = p > 0xFFFF ? 0xFFFF : p;
+    *phase = angle[1] - angle[0]; //I/Q angle runs opposite to the signal phase
+    return 0;
+}
+
+uint16 get_reciprocal_frequency(BYTE channel, BYTE mode, uint16 gate, unsigned long *edges, unsigned long *elapsed) {
+    /* Reciprocal counter. IC1/IC2 timestamp every (1,4,16)th rising edge at Fp into ADCbuffer like the one channel
+     * LA, for roughly 'gate' Timer5 ticks (1:256). The measurement then spans whole input periods between the first
+     * and last captured edges, so f = edges*64e6/elapsed has the same relative resolution at any input frequency.
+     * Returns the number of captures. Fewer than 2 means no complete period was seen.*/
+    uint16 captures, last;
+    BYTE per_capture = 1, tracking;
+    if (mode == EVERY_FOURTH_RISING_EDGE)per_capture = 4;
+    else if (mode == EVERY_SIXTEENTH_RISING_EDGE)per_capture = 16;
+    else mode = EVERY_RISING_EDGE;
+
+    _IC4IE = 0;
+    stop_frequency_monitor(); //Timer5
+    tracking = LA_PROGRESS_TRACKING;
+    LA_PROGRESS_TRACKING = 1; //the capture count below comes from LA_write_index
+    start_1chan_LA(BUFFER_SIZE / 4, channel, mode, 0);
+    LA_PROGRESS_TRACKING = tracking;
+
+    T5CONbits.TON = 0;
+    T5CONbits.TCKPS = 3; //1:256 , 4uS per tick
+    PR5 = gate;
+    TMR5 = 0x0000;
+    _T5IE = 0; //the gate is polled on _T5IF. An ISR would clear it first
+    _T5IF = 0;
+    IC1CON2bits.TRIGSTAT = 1;
+    IC2CON2bits.TRIGSTAT = 1;
+    T5CONbits.TON = 1;
+    while (!_T5IF && DMA0CONbits.CHEN)asm("CLRWDT"); //the buffer may fill up before the gate closes
+    IC1CON1bits.ICM = 0; //captures for IC1 and IC2 come from the same event, so both halves stay consistent
+    IC2CON1bits.ICM = 0;
+    T5CONbits.TON = 0;
+    _T5IF = 0;
+
+    captures = LA_write_index(0);
+    *edges = 0;
+    *elapsed = 0;
+    if (captures >= 2) {
+        last = captures - 1;
+        *edges = (unsigned long) last * per_capture;
+        *elapsed = (((unsigned long) (uint16) ADCbuffer[last + BUFFER_SIZE / 4] << 16) | (uint16) ADCbuffer[last])
+                - (((unsigned long) (uint16) ADCbuffer[BUFFER_SIZE / 4] << 16) | (uint16) ADCbuffer[0]);
+    }
+    disable_input_capture();
+    DMA0CONbits.CHEN = 0;
+    DMA1CONbits.CHEN = 0;
+    return captures;
+}
+
 void init_IC_for_frequency(BYTE capture_pin, BYTE capture_mode, BYTE captures_per_interrupt) {
+    stop_phase_monitor(); //IC1/IC2
+    cancel_timing_job();
+    _IC1IE = 0; //polled, unless start_timing_job enables it
 
     RPINR7bits.IC1R = DIN_REMAPS[capture_pin];
 
@@ -225,6 +1012,7 @@ void init_IC_for_frequency(BYTE capture_pin, BYTE capture_mode, BYTE captures_pe
 }
 
 void startCounting(BYTE channel) {
+    stop_dac_stream(); //Timer2
     T2CONbits.TON = 0;
     T2CONbits.T32 = 0;
     T2CONbits.TCS = 1; // Select External clock
@@ -235,6 +1023,12 @@ void startCounting(BYTE channel) {
 }
 
 void TimingMeasurements(BYTE capture_pin1, BYTE capture_pin2, BYTE pin1_edge, BYTE pin2_edge, BYTE interrupts1, BYTE interrupts2) {
+    stop_dac_stream(); //Timer2
+    stop_frequency_monitor();
+    stop_phase_monitor(); //IC1-IC4
+    cancel_timing_job();
+    _IC1IE = 0;
+    _IC3IE = 0;
     _IC1IF = 0;
     _IC3IF = 0;
     if (capture_pin1 == 4) EnableComparator();
@@ -294,6 +1088,10 @@ void TimingMeasurements(BYTE capture_pin1, BYTE capture_pin2, BYTE pin1_edge, BY
 }
 
 void Interval(BYTE capture_pin1, BYTE capture_pin2, BYTE pin1_edge, BYTE pin2_edge) {
+    stop_phase_monitor(); //IC1-IC4
+    cancel_timing_job();
+    _IC1IE = 0;
+    _IC3IE = 0;
 
     RPINR7bits.IC1R = DIN_REMAPS[capture_pin1];
     RPINR8bits.IC3R = DIN_REMAPS[capture_pin2];
@@ -402,6 +1200,8 @@ void start_1chan_LA(unsigned int data_points, BYTE channel, BYTE mode, BYTE trig
     DMA0STAL = __builtin_dmaoffset(&ADCbuffer);
     DMA1STAH = __builtin_dmapage((int*) (ADCbuffer + BUFFER_SIZE / 4));
     DMA1STAL = __builtin_dmaoffset((int*) (ADCbuffer + BUFFER_SIZE / 4));
+    LA_WRAP_TRACKING = 0; //Fp timebase, nothing to extend
+    LA_prepare_buffers(data_points, 2);
 
     IC1CON1bits.ICOV = 0;
     IC2CON1bits.ICOV = 0; //reset overflow flag
@@ -498,6 +1298,8 @@ void start_2chan_LA(unsigned int data_points, BYTE modes, BYTE locations) {
     DMA3STAH = __builtin_dmapage((int*) (ADCbuffer + 3 * BUFFER_SIZE / 4));
     DMA1STAL = __builtin_dmaoffset((int*) (ADCbuffer + BUFFER_SIZE / 4));
     DMA3STAL = __builtin_dmaoffset((int*) (ADCbuffer + 3 * BUFFER_SIZE / 4));
+    LA_WRAP_TRACKING = 0; //Fp timebase, nothing to extend
+    LA_prepare_buffers(data_points, 4);
 
     _DMA0IF = 0; // Clear the DMA interrupt flag bit
     _DMA0IE = 1; // Enable DMA interrupt enable bit
@@ -604,6 +1406,8 @@ void start_3chan_LA(unsigned int data_points, unsigned int modes, BYTE trigchan)
     DMA1STAL = __builtin_dmaoffset((int*) (ADCbuffer + BUFFER_SIZE / 4));
     DMA2STAH = __builtin_dmapage((int*) (ADCbuffer + BUFFER_SIZE / 2));
     DMA2STAL = __builtin_dmaoffset((int*) (ADCbuffer + BUFFER_SIZE / 2));
+    LA_WRAP_TRACKING = 0; //Fp timebase, nothing to extend
+    LA_prepare_buffers(data_points, 3);
 
     _DMA0IF = 0; // Clear the DMA interrupt flag bit
     _DMA0IE = 1; // Enable DMA interrupt enable bit
@@ -711,6 +1515,13 @@ void start_4chan_LA(unsigned int data_points, unsigned int modes, BYTE scale) {
     DMA2STAL = __builtin_dmaoffset((int*) (ADCbuffer + BUFFER_SIZE / 2));
     DMA3STAL = __builtin_dmaoffset((int*) (ADCbuffer + 3 * BUFFER_SIZE / 4));
 
+    /*Track Timer2 wraps so that every edge can be extended to 32 bits*/
+    LA_WRAP_TRACKING = 1; //the wrap table needs the write index, so the buffers are always marked
+    LA_prepare_buffers(data_points, 4);
+    PR2 = 0xFFFF;
+    _T2IF = 0;
+    _T2IE = 1; //Timer2 only starts once the capture is released
+
     _DMA0IF = 0; // Clear the DMA interrupt flag bit
     _DMA0IE = 1; // Enable DMA interrupt enable bit
     DMA0CONbits.CHEN = 1;
@@ -725,6 +1536,8 @@ void start_4chan_LA(unsigned int data_points, unsigned int modes, BYTE scale) {
 }
 
 void disable_input_capture() {
+    LA_WRAP_TRACKING = 0;
+    _T2IE = 0;
     IC1CON2bits.TRIGSTAT = 0;
     IC2CON2bits.TRIGSTAT = 0;
     IC3CON2bits.TRIGSTAT = 0;
@@ -748,6 +1561,8 @@ void disable_input_capture() {
 }
 
 void alternate_get_high_frequency(BYTE channel, BYTE scale) { //Measure freq using only input captures. Timer 3 not available
+    stop_dac_stream(); //Timer2
+    stop_frequency_monitor(); //Timer5
 
     RPINR7bits.IC1R = 0;
     RPINR7bits.IC2R = 0;
@@ -794,3 +1609,307 @@ void alternate_get_high_frequency(BYTE channel, BYTE scale) { //Measure freq usi
     IC2CON2bits.TRIGSTAT = 1;
     IC1CON2bits.TRIGSTAT = 1;
 }
+
+void arm_LA_trigger() {
+    /* Timer2 measures the window between stages. The four channel LA already clocks its captures from Timer2, so
+     * its prescaler is left alone. ICxTMR is internal to each module, so TMR2 can be reset freely. */
+    stop_dac_stream(); //Timer2
+    if (IC1CON1bits.ICTSEL != 0b1) {
+        T2CONbits.TON = 0;
+        T2CONbits.T32 = 0;
+        T2CONbits.TCS = 0;
+        T2CONbits.TCKPS = 3; //1:256 , 4uS per tick
+    }
+    PR2 = 0xFFFF;
+    TMR2 = 0x0000;
+    _T2IF = 0;
+    _T2IE = 0; //wrap tracking resumes on release. _T2IF is the stage window overflow until then
+    T2CONbits.TON = 1;
+
+    LA_TRIGGER_STAGE = 0;
+    LA_TRIGGER_LAST = ((PORTB >> 10)&0xF) | (_C4OUT << 4);
+    if (LA_trigger_process(LA_TRIGGER_LAST)) { //a pure pattern stage may already be satisfied
+        release_LA_trigger();
+        return;
+    }
+    _CNIEB10 = 1;
+    _CNIEB11 = 1;
+    _CNIEB12 = 1;
+    _CNIEB13 = 1; //C4OUT does not raise CN interrupts. It is only sampled as part of the pattern
+    _CNIF = 0;
+    _CNIE = 1;
+}
+
+void disarm_LA_trigger() {
+    _CNIEB10 = 0;
+    _CNIEB11 = 0;
+    _CNIEB12 = 0;
+    _CNIEB13 = 0;
+    _CNIF = 0;
+    _CNIE = 0;
+    LA_TRIGGER_STAGE = 0;
+}
+
+BYTE LA_trigger_process(BYTE state) { //returns 1 once the final stage has matched
+    BYTE edge, bit, match;
+    if (LA_TRIGGER_STAGE && LA_TRIGGER_WINDOW && (_T2IF || TMR2 > LA_TRIGGER_WINDOW))LA_TRIGGER_STAGE = 0; //too late. start over
+
+    edge = LA_TRIGGER_EDGE[LA_TRIGGER_STAGE];
+    match = (state & LA_TRIGGER_MASK[LA_TRIGGER_STAGE]) == LA_TRIGGER_VALUE[LA_TRIGGER_STAGE];
+    if (match && (edge & LA_TRIGGER_EDGE_CHANNEL)) {
+        bit = 1 << ((edge & LA_TRIGGER_EDGE_CHANNEL) - 1);
+        if (!((state ^ LA_TRIGGER_LAST) & bit))match = 0; //this channel did not change
+        else if (edge & LA_TRIGGER_EDGE_FALLING)match = (state & bit) == 0;
+        else match = (state & bit) != 0;
+    }
+    LA_TRIGGER_LAST = state;
+    if (!match)return 0;
+
+    TMR2 = 0x0000;
+    _T2IF = 0;
+    LA_TRIGGER_STAGE++;
+    return LA_TRIGGER_STAGE >= LA_TRIGGER_STAGES;
+}
+
+void release_LA_trigger() {
+    /* Decide which modules are running first, so that the TRIGSTAT writes go out back to back */
+    BYTE ic1 = IC1CON1bits.ICM != 0, ic2 = IC2CON1bits.ICM != 0, ic3 = IC3CON1bits.ICM != 0, ic4 = IC4CON1bits.ICM != 0;
+    disarm_LA_trigger();
+    if (IC1CON1bits.ICTSEL == 0b1) { //four channel LA. Realign Timer2 with the capture timebase
+        TMR2 = 0x0001;
+        _T2IF = 0;
+        _T2IE = LA_WRAP_TRACKING;
+    }
+    INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4);
+    if (ic1)IC1CON2bits.TRIGSTAT = 1;
+    if (ic2)IC2CON2bits.TRIGSTAT = 1;
+    if (ic3)IC3CON2bits.TRIGSTAT = 1;
+    if (ic4)IC4CON2bits.TRIGSTAT = 1;
+    INITIAL_DIGITAL_STATES_ERR = ((PORTB >> 10)&0xF) | (_C4OUT << 4);
+    if (IC1CON1bits.ICTSEL != 0b1)T2CONbits.TON = 0; //Timer2 was only needed for the stage window
+}
+
+void LA_prepare_buffers(unsigned int data_points, BYTE channels) {
+    /*Mark the capture quarters as empty so that LA_write_index can report progress. That is a full buffer write,
+     so it is skipped unless the host asked for progress or the four channel LA keeps a wrap table*/
+    BYTE channel;
+    uint16 n;
+    stop_dac_stream(); //Timer2 belongs to the LA from here
+    stop_pattern(); //and ADCbuffer, DMA2, INT2
+    LASamples = data_points;
+    _T2IE = 0; //a wrap table left by an earlier four channel capture must not outlive it
+    LA_WRAP_ENTRIES[0] = LA_WRAP_ENTRIES[1] = LA_WRAP_ENTRIES[2] = LA_WRAP_ENTRIES[3] = 0;
+    LA_WRAPS = 0;
+    LA_BUFFERS_MARKED = LA_PROGRESS_TRACKING || LA_WRAP_TRACKING;
+    for (channel = 0; channel < 4; channel++) {
+        LA_SCAN_POS[channel] = channel < channels ? 0 : data_points;
+        if (LA_BUFFERS_MARKED && channel < channels)for (n = 0; n < data_points; n++)ADCbuffer[n + channel * (BUFFER_SIZE / 4)] = LA_EMPTY_SLOT;
+    }
+}
+
+uint16 LA_write_index(BYTE channel) {
+    /* DMA does not expose its current address, so walk forward over written slots. A real timestamp equal to
+     * LA_EMPTY_SLOT is only mistaken for an empty slot while it is the most recent edge. With a zero marker that edge
+     * was captured on the first tick of an epoch, so LA_record_wrap still files it under the epoch just started.
+     * Called from main and from the Timer2 ISR, so LA_SCAN_POS is only touched with _T2IE off*/
+    int *buf = &ADCbuffer[channel * (BUFFER_SIZE / 4)];
+    BYTE t2ie = _T2IE;
+    uint16 pos;
+    if (!LA_BUFFERS_MARKED)return 0; //not tracked for this capture
+    _T2IE = 0;
+    pos = LA_SCAN_POS[channel];
+    while (pos < LASamples && (buf[pos] != (int) LA_EMPTY_SLOT || (pos + 1 < LASamples && buf[pos + 1] != (int) LA_EMPTY_SLOT)))pos++;
+    LA_SCAN_POS[channel] = pos;
+    _T2IE = t2ie;
+    return pos;
+}
+
+void LA_record_wrap() {
+    BYTE channel, n;
+    uint16 pos;
+    if (!LA_WRAP_TRACKING || !(DMA0CONbits.CHEN || DMA1CONbits.CHEN || DMA2CONbits.CHEN || DMA3CONbits.CHEN)) {
+        LA_WRAP_TRACKING = 0; //capture complete
+        _T2IE = 0;
+        return;
+    }
+    LA_WRAPS++;
+    for (channel = 0; channel < 4; channel++) {
+        pos = LA_write_index(channel);
+        n = LA_WRAP_ENTRIES[channel];
+        if (n && LA_WRAP_INDEX[channel][n - 1] == pos)LA_WRAP_EPOCH[channel][n - 1] = LA_WRAPS; //no edges since the last wrap
+        else if (n < LA_MAX_WRAP_ENTRIES) {
+            LA_WRAP_INDEX[channel][n] = pos;
+            LA_WRAP_EPOCH[channel][n] = LA_WRAPS;
+            LA_WRAP_ENTRIES[channel]++;
+        }
+    }
+}
+
+void start_mixed_signal(unsigned int samples, unsigned int edges, BYTE analog_channel, BYTE digital_channel, BYTE mode, BYTE trigger) {
+    /* Analog : DMA0 -> ADCbuffer[0 : BUFFER_SIZE/2] , one sample per Timer5 period (ADC_DELAY)
+     * Digital: IC1:IC2 cascade clocked by Timer5 -> ADCbuffer[BUFFER_SIZE/2 : ] , 32 bit timestamps in Timer5 ticks,
+     *          lsw first. A 16 bit capture would wrap every 65536 ticks, and DMA moves one word per request, so
+     *          _IC1Interrupt copies both halves, as with the other IC1:IC2 cascades.
+     * Sample k was converted at (k+1)*ADC_DELAY ticks , so both traces share one time axis.
+     * DMA2/DMA3 are left to the wave generator.*/
+    disable_input_capture();
+    stop_pattern();
+    stop_frequency_monitor(); //Timer5, ADCbuffer
+    stop_phase_monitor(); //IC1
+    cancel_timing_job();
+    DMA1CONbits.CHEN = 0;
+    _IC1IE = 0;
+    MIXED_SIGNAL_TRIGGERED = 0;
+    MIXED_SIGNAL_EDGES = 0;
+    MIXED_SIGNAL_EDGE_LIMIT = edges;
+    _INT2IE = 0;
+
+    if (analog_channel & 0x80)setADCMode(ADC_12BIT_DMA, analog_channel & 0x7F, 0);
+    else setADCMode(ADC_10BIT_DMA, analog_channel & 0x7F, 0);
+    T5CONbits.TON = 0;
+    DMA_MODE = DMA_MIXED_SIGNAL; //_DMA0Interrupt must leave IC1 running
+    AD1CON2bits.CHPS = 0;
+    ADC_CHANNELS = 0;
+    samples_to_fetch = samples;
+    DMA0CONbits.AMODE = 0b00; //setADCMode may have been a no-op, and the LA reassigns DMA0
+    DMA0CONbits.MODE = 0b01;
+    DMA0CONbits.DIR = 0;
+    DMA0REQ = 0b1101; // ADC
+    enableADCDMA();
+    DMA0STAH = __builtin_dmapage(&ADCbuffer[0]);
+    DMA0STAL = __builtin_dmaoffset(&ADCbuffer[0]);
+    DMA0PAD = (int) &ADC1BUF0;
+    DMA0CNT = samples - 1;
+
+    if (digital_channel == 4) EnableComparator();
+    RPINR7bits.IC1R = DIN_REMAPS[digital_channel]; //the odd module takes the input in cascade mode
+    IC1CON1bits.ICM = 0;
+    IC2CON1bits.ICM = 0;
+    IC1CON1bits.ICOV = 0;
+    IC2CON1bits.ICOV = 0;
+    IC1CON1bits.ICTSEL = 0b011; //Timer5 clock. Same timebase as the ADC
+    IC2CON1bits.ICTSEL = 0b011;
+    IC1CON1bits.ICI = 0;
+    IC2CON1bits.ICI = 0;
+    IC1CON2bits.IC32 = 1;
+    IC2CON2bits.IC32 = 1;
+    IC1CON2bits.TRIGSTAT = 0;
+    IC2CON2bits.TRIGSTAT = 0;
+    IC1CON2bits.SYNCSEL = 0;
+    IC2CON2bits.SYNCSEL = 0;
+    IC1CON2bits.ICTRIG = 1;
+    IC2CON2bits.ICTRIG = 1;
+
+    T5CONbits.TCKPS = 1;
+    PR5 = ADC_DELAY - 1;
+    TMR5 = 0x0000;
+    _DMA0IF = 0;
+    _DMA0IE = 1;
+    _IC1IF = 0;
+    _IC1IE = 1;
+    DMA0CONbits.CHEN = 1;
+    IC1CON1bits.ICM = mode;
+    IC2CON1bits.ICM = mode;
+
+    if (trigger & 1) { //[7:4-channel,1-falling edge,0-enable]. Both acquisitions start from _INT2Interrupt
+        INTCON2bits.INT2EP = (trigger >> 1)&1;
+        RPINR1bits.INT2R = DIN_REMAPS[(trigger >> 4)&0xF];
+        _INT2IF = 0;
+        _INT2IE = 1;
+    } else release_mixed_signal();
+}
+
+void release_mixed_signal() {
+    INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4);
+    IC1CON2bits.TRIGSTAT = 1;
+    IC2CON2bits.TRIGSTAT = 1;
+    T5CONbits.TON = 1;
+    /*Both counters start from zero here. Read them back to back to report the residual skew*/
+    MIXED_SIGNAL_TMR5 = TMR5;
+    MIXED_SIGNAL_ICTMR = IC1TMR;
+    MIXED_SIGNAL_TRIGGERED = 1;
+}
+
+void mixed_signal_latch() { //called from _IC1Interrupt. Empties the cascade FIFO, lsw (IC1) before msw (IC2)
+    uint16 *dest = (uint16 *) &ADCbuffer[BUFFER_SIZE / 2 + 2 * MIXED_SIGNAL_EDGES];
+    while (IC1CON1bits.ICBNE && MIXED_SIGNAL_EDGES < MIXED_SIGNAL_EDGE_LIMIT) {
+        *dest++ = IC1BUF;
+        *dest++ = IC2BUF;
+        MIXED_SIGNAL_EDGES++;
+    }
+    if (MIXED_SIGNAL_EDGES >= MIXED_SIGNAL_EDGE_LIMIT) {
+        _IC1IE = 0;
+        IC1CON2bits.TRIGSTAT = 0;
+        IC2CON2bits.TRIGSTAT = 0;
+        IC1CON1bits.ICM = 0;
+        IC2CON1bits.ICM = 0;
+    }
+}
+
+void start_timing_job(BYTE job, uint16 timeout, BYTE pairs1, BYTE pairs2) {
+    /*Call after the usual setup function (init_IC_for_frequency, TimingMeasurements, Interval). Instead of spinning
+     on _IC1IF/_IC3IF, let the interrupts collect the results while the main loop keeps serving commands*/
+    TIMING_JOB = job;
+    TIMING_JOB_TIMEOUT_TICKS = timeout;
+    TIMING_JOB_PAIRS1 = pairs1 > TIMING_JOB_MAX_PAIRS ? TIMING_JOB_MAX_PAIRS : pairs1;
+    TIMING_JOB_PAIRS2 = pairs2 > TIMING_JOB_MAX_PAIRS ? TIMING_JOB_MAX_PAIRS : pairs2;
+    TIMING_JOB_STATE = TIMING_JOB_PAIRS2 ? 0 : 2; //bit 0 : pin 1 latched , bit 1 : pin 2 latched
+    TIMING_JOB_FLAGS = TIMING_JOB_BUSY;
+    _IC1IF = 0;
+    _IC1IE = 1;
+    if (TIMING_JOB_PAIRS2) {
+        _IC3IF = 0;
+        _IC3IE = 1;
+    }
+}
+
+void cancel_timing_job() { //a new owner takes IC1-IC4. FETCH_TIMING_JOB reports a timeout
+    if (TIMING_JOB == TIMING_JOB_NONE || TIMING_JOB_STATE == 3)return;
+    _IC1IE = 0;
+    _IC3IE = 0;
+    TIMING_JOB_STATE = 3;
+    TIMING_JOB_FLAGS = TIMING_JOB_TIMEOUT;
+}
+
+void timing_job_latch(BYTE pin) {
+    BYTE n;
+    uint16 *dest = &TIMING_JOB_DATA[0];
+    if (pin == 1) {
+        _IC1IE = 0;
+        for (n = 0; n < TIMING_JOB_PAIRS1; n++) {
+            *dest++ = IC1BUF;
+            *dest++ = IC2BUF;
+        }
+        TIMING_JOB_STATE |= 1;
+    } else {
+        _IC3IE = 0;
+        dest += 2 * TIMING_JOB_PAIRS1;
+        for (n = 0; n < TIMING_JOB_PAIRS2; n++) {
+            *dest++ = IC3BUF;
+            *dest++ = IC4BUF;
+        }
+        TIMING_JOB_STATE |= 2;
+    }
+    if (TIMING_JOB_STATE != 3)return;
+
+    TIMING_JOB_TMR = IC2TMR;
+    if (IC1CON1bits.ICOV || IC2CON1bits.ICOV || IC3CON1bits.ICOV || IC4CON1bits.ICOV)TIMING_JOB_FLAGS |= TIMING_JOB_OVERFLOW;
+    if (!(TIMING_JOB_FLAGS & TIMING_JOB_TIMEOUT))TIMING_JOB_FLAGS |= TIMING_JOB_DONE;
+    RPINR7bits.IC1R = 0; //disconnect
+    disable_input_capture();
+    if (TIMING_JOB == TIMING_JOB_MEASUREMENTS)T2CONbits.TON = 0;
+}
+
+BYTE timing_job_status() {
+    if (TIMING_JOB == TIMING_JOB_NONE)return TIMING_JOB_TIMEOUT;
+    if (TIMING_JOB_STATE != 3 && IC2TMR >= TIMING_JOB_TIMEOUT_TICKS) { //same timeout as the blocking commands
+        _IC1IE = 0;
+        _IC3IE = 0; //the ISRs latch too. Both pins are latched below, so they stay off
+        if (TIMING_JOB_STATE != 3) { //an ISR may have finished the job in the meantime
+            TIMING_JOB_FLAGS |= TIMING_JOB_TIMEOUT;
+            if (!(TIMING_JOB_STATE & 1))timing_job_latch(1);
+            if (!(TIMING_JOB_STATE & 2))timing_job_latch(2);
+        }
+    }
+    return TIMING_JOB_FLAGS;
+}
@@ -10,12 +10,53 @@
 
 extern BYTE DIN_REMAPS[], LAM1, LAM2, LAM3, LAM4;
 extern BYTE INITIAL_DIGITAL_STATES;
+extern BYTE LA_TRIGGER_STAGES, LA_TRIGGER_STAGE;
+extern BYTE LA_TRIGGER_MASK[], LA_TRIGGER_VALUE[], LA_TRIGGER_EDGE[];
+extern uint16 LA_TRIGGER_WINDOW;
+extern BYTE FREQ_MONITOR_RUNNING, FREQ_MONITOR_OVERRUN;
+extern uint16 FREQ_MONITOR_SEQ, FREQ_MONITOR_READ, FREQ_MONITOR_WRITE;
+extern BYTE MULTI_FREQ_CHANNELS, MULTI_FREQ_DONE, MULTI_FREQ_STATES, MULTI_FREQ_INPUTS[4];
+extern uint16 MULTI_FREQ_DATA[4][MULTI_FREQ_EDGES];
+extern unsigned long HISTOGRAM_MIN, HISTOGRAM_MAX, HISTOGRAM_MEAN;
+extern uint16 HISTOGRAM_COUNT, HISTOGRAM_UNDER, HISTOGRAM_OVER;
+extern BYTE PHASE_MONITOR_RUNNING, PHASE_MONITOR_OVERRUN;
+extern uint16 PHASE_MONITOR_SEQ, PHASE_MONITOR_READ, PHASE_MONITOR_WRITE;
+extern unsigned long PHASE_MONITOR_MIN, PHASE_MONITOR_MAX, PHASE_MONITOR_COUNT;
+extern unsigned long long PHASE_MONITOR_DELAY_SUM, PHASE_MONITOR_PERIOD_SUM;
+extern BYTE TIMING_JOB, TIMING_JOB_STATE, TIMING_JOB_PAIRS1, TIMING_JOB_PAIRS2;
+extern uint16 TIMING_JOB_DATA[], TIMING_JOB_TMR;
+extern BYTE MIXED_SIGNAL_TRIGGERED;
+extern uint16 MIXED_SIGNAL_TMR5, MIXED_SIGNAL_ICTMR;
+extern uint16 MIXED_SIGNAL_EDGES, MIXED_SIGNAL_EDGE_LIMIT;
+extern BYTE LA_WRAP_TRACKING, LA_WRAP_ENTRIES[];
+extern BYTE LA_PROGRESS_TRACKING, LA_BUFFERS_MARKED;
+extern uint16 LA_WRAPS, LA_SCAN_POS[], LA_WRAP_INDEX[][LA_MAX_WRAP_ENTRIES], LA_WRAP_EPOCH[][LA_MAX_WRAP_ENTRIES];
 
 extern void set_cap_voltage(BYTE v, unsigned int time);
+extern void discharge_cap(unsigned int timeout);
+extern BYTE wait_for_discharge(BYTE channel, unsigned int timeout);
 extern unsigned int get_cc_capacitance(BYTE current_range, BYTE trimval, unsigned int ChargeTime);
 extern unsigned int get_cap_range(unsigned int);
+extern BYTE get_capacitance_autorange(BYTE trimval, BYTE *current_range, unsigned int *ChargeTime, unsigned int *reading);
 extern unsigned int get_ctmu_voltage(BYTE, BYTE, BYTE);
+extern void ctmu_sweep(BYTE channel, BYTE tgen, int *steps, uint16 count, int *readings);
 extern void get_high_frequency(BYTE, BYTE);
+extern void start_frequency_monitor(BYTE channel, BYTE scale, uint16 gate);
+extern void stop_frequency_monitor();
+extern void frequency_monitor_sample();
+extern void start_multi_frequency(BYTE count, BYTE scale);
+extern void multi_frequency_latch(BYTE module);
+extern void stop_multi_frequency();
+extern BYTE timing_histogram(BYTE channel, BYTE mode, uint16 samples, unsigned long origin, BYTE shift, uint16 bins, uint16 timeout);
+extern void start_phase_monitor(BYTE pin1, BYTE pin2, BYTE pin1_edge, BYTE pin2_edge);
+extern void stop_phase_monitor();
+extern void phase_monitor_latch(BYTE pin);
+extern uint16 phase_of(unsigned long delay, unsigned long period);
+extern BYTE fit_rc_curve(uint16 start, uint16 count, uint16 full_scale, uint16 vinf_override, unsigned long *tau, uint16 *v0, uint16 *vinf, uint16 *residual, uint16 *used);
+extern BYTE get_echo_delay(uint16 samples, uint16 burst, uint16 first_lag, uint16 last_lag, long *lag, uint16 *score);
+extern int sin_q15(BYTE index);
+extern BYTE bode_point(BYTE channel, unsigned long tuning, uint16 cycles, uint16 settle, uint16 max_samples, uint16 *gain, int *phase);
+extern uint16 get_reciprocal_frequency(BYTE channel, BYTE mode, uint16 gate, unsigned long *edges, unsigned long *elapsed);
 extern void init_IC_for_frequency(BYTE capture_pin, BYTE capture_mode, BYTE captures_per_interrupt);
 extern void startCounting(BYTE channel);
 extern void TimingMeasurements(BYTE, BYTE, BYTE, BYTE, BYTE, BYTE);
@@ -27,6 +68,20 @@ extern void start_3chan_LA(unsigned int, unsigned int, BYTE);
 extern void start_4chan_LA(unsigned int, unsigned int, BYTE);
 extern void disable_input_capture();
 extern void alternate_get_high_frequency(BYTE channel, BYTE scale);
+extern void arm_LA_trigger();
+extern void disarm_LA_trigger();
+extern BYTE LA_trigger_process(BYTE state);
+extern void release_LA_trigger();
+extern void LA_prepare_buffers(unsigned int data_points, BYTE channels);
+extern uint16 LA_write_index(BYTE channel);
+extern void LA_record_wrap();
+extern void start_timing_job(BYTE job, uint16 timeout, BYTE pairs1, BYTE pairs2);
+extern void timing_job_latch(BYTE pin);
+extern BYTE timing_job_status();
+extern void cancel_timing_job();
+extern void start_mixed_signal(unsigned int samples, unsigned int edges, BYTE analog_channel, BYTE digital_channel, BYTE mode, BYTE trigger);
+extern void release_mixed_signal();
+extern void mixed_signal_latch();
 // Todo : Implement Logic analyser functions
 extern void enableLogicAnalyser();
 extern void disableLogicAnalyser();
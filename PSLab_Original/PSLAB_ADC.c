@@ -5,6 +5,8 @@
 #include "Common_Functions.h"
 #include "PSLAB_SPI.h"
 #include "PSLAB_ADC.h"
+#include "Wave_Generator.h"
+#include "Measurements.h"
 
 BYTE CHOSA = 3;
 BYTE CH123SA = 0;
@@ -345,10 +347,13 @@ uint16 get_voltage(BYTE channel) {
 }
 
 void setupADC10() {
+    stop_pattern(); //the capture overwrites ADCbuffer
+    stop_frequency_monitor(); //and takes Timer5
+    if (SYNC_HOLD & SYNC_ADC)T5CONbits.TON = 0; //the scope init may have started it. SYNC_START does
     T5CONbits.TCKPS = 1;
     PR5 = ADC_DELAY - 1;
     TMR5 = 0x0000;
-    T5CONbits.TON = 1;
+    if (!(SYNC_HOLD & SYNC_ADC))T5CONbits.TON = 1;
 
 }
 
@@ -10,6 +10,12 @@ uint16 I2C_BRGVAL = 0x272;
 BYTE MULTIFUNC_PORT = 0;
 uint16 tmp_int1 = 0;
 
+/*-----DAC stream. Timer2 starts a frame, _MI2C2Interrupt clocks it out one bus event at a time-----*/
+BYTE DAC_STREAM_STATE = DAC_STREAM_IDLE, DAC_STREAM_ADDRESS = 0, DAC_STREAM_FLAGS = 0;
+BYTE DAC_STREAM_BYTE = 0; //0 : idle, 1 : start sent, 2 : address sent, 3-10 : data sent, 11 : stop sent
+uint16 DAC_STREAM_FRAME = 0, DAC_STREAM_FRAMES = 0, DAC_STREAM_LATE = 0;
+uint16 DAC_STREAM_TABLE[DAC_STREAM_MAX_FRAMES * DAC_STREAM_CHANNELS]; //frames of channel A-D, 12 bit
+
 void initI2C(void) {
 
     _TRISB4 = 1; // set SCL and SDA pins as inputs.
@@ -118,3 +124,95 @@ void setMultiFuncPortMode(BYTE mode) {
 
     }
 }
+
+void start_dac_stream(BYTE address, uint16 frames, uint16 period, BYTE flags) {
+    /* Each Timer2 period sends one frame of DAC_STREAM_TABLE as an MCP4728 fast write, so all four outputs change
+     * in one transaction. Timer2 is shared with the logic analyser*/
+    stop_dac_stream();
+    I2C2BRG = 0x90;
+    setMultiFuncPortMode(MULTIFUNC_I2C);
+    DAC_STREAM_ADDRESS = address; //address<<1 | R/W , as SET_DAC
+    DAC_STREAM_FRAMES = frames;
+    DAC_STREAM_FLAGS = flags;
+    DAC_STREAM_FRAME = 0;
+    DAC_STREAM_LATE = 0;
+    DAC_STREAM_BYTE = 0;
+    DAC_STREAM_STATE = DAC_STREAM_RUNNING;
+
+    T2CON = 0;
+    T2CONbits.TCKPS = 2; //1uS
+    PR2 = period - 1;
+    TMR2 = 0;
+    _MI2C2IF = 0;
+    _MI2C2IE = 1;
+    _T2IF = 0;
+    _T2IE = 1;
+    T2CONbits.TON = 1;
+    dac_stream_tick(); //first frame right away
+}
+
+void stop_dac_stream() {
+    if (DAC_STREAM_STATE == DAC_STREAM_RUNNING) {
+        T2CONbits.TON = 0;
+        _T2IE = 0;
+    }
+    _MI2C2IE = 0;
+    if (DAC_STREAM_BYTE) {
+        I2C2CONbits.PEN = 1; //do not leave the bus claimed mid frame
+        tmp_int1 = 1000;
+        while (I2C2CONbits.PEN && tmp_int1--)Delay_us(1);
+        DAC_STREAM_BYTE = 0;
+    }
+    if (DAC_STREAM_STATE == DAC_STREAM_RUNNING)DAC_STREAM_STATE = DAC_STREAM_IDLE;
+}
+
+void dac_stream_tick() { //Timer2 period
+    if (DAC_STREAM_BYTE) { //previous frame still on the bus. Skip this one
+        DAC_STREAM_LATE++;
+        return;
+    }
+    DAC_STREAM_BYTE = 1;
+    I2C2CONbits.SEN = 1;
+}
+
+void dac_stream_next() { //the last start, byte or stop has completed
+    uint16 word;
+    if (DAC_STREAM_BYTE >= 2 && DAC_STREAM_BYTE <= 10 && I2C2STATbits.ACKSTAT) { //no DAC at this address
+        I2C2CONbits.PEN = 1;
+        DAC_STREAM_BYTE = 11;
+        DAC_STREAM_STATE = DAC_STREAM_NACK;
+        T2CONbits.TON = 0;
+        _T2IE = 0;
+        return;
+    }
+    if (DAC_STREAM_BYTE == 1)I2C2TRN = DAC_STREAM_ADDRESS;
+    else if (DAC_STREAM_BYTE <= 9) {
+        word = DAC_STREAM_TABLE[DAC_STREAM_FRAME * DAC_STREAM_CHANNELS + ((DAC_STREAM_BYTE - 2) >> 1)];
+        if (DAC_STREAM_BYTE & 1)I2C2TRN = word & 0xFF;
+        else I2C2TRN = (word >> 8)&0x0F; //fast write : 0,0,PD1,PD0,D11-D8. Normal power mode
+    } else if (DAC_STREAM_BYTE == 10)I2C2CONbits.PEN = 1;
+    else {
+        DAC_STREAM_BYTE = 0;
+        _MI2C2IE = (DAC_STREAM_STATE == DAC_STREAM_RUNNING);
+        if (DAC_STREAM_STATE != DAC_STREAM_RUNNING)return;
+        if (++DAC_STREAM_FRAME >= DAC_STREAM_FRAMES) {
+            if (DAC_STREAM_FLAGS & DAC_STREAM_LOOP)DAC_STREAM_FRAME = 0;
+            else {
+                DAC_STREAM_FRAME--;
+                T2CONbits.TON = 0;
+                _T2IE = 0;
+                _MI2C2IE = 0;
+                DAC_STREAM_STATE = DAC_STREAM_DONE;
+            }
+        }
+        return;
+    }
+    DAC_STREAM_BYTE++;
+}
+
+void fill_dac_ramp(BYTE channel, uint16 start, uint16 stop, uint16 frames) {
+    //straight line from start to stop on one channel of the stream table. The other channels are left alone
+    uint16 n;
+    long step = frames > 1 ? ((((long) stop - (long) start) << 12) / (frames - 1)) : 0;
+    for (n = 0; n < frames; n++)DAC_STREAM_TABLE[n * DAC_STREAM_CHANNELS + channel] = start + ((step * n + 2048) >> 12);
+}
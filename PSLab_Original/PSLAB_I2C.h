@@ -23,5 +23,14 @@ extern void I2CSend(BYTE dat);
 extern BYTE I2CRead(BYTE ack);
 extern void setMultiFuncPortMode(BYTE mode);
 
+extern BYTE DAC_STREAM_STATE;
+extern uint16 DAC_STREAM_FRAME, DAC_STREAM_LATE;
+extern uint16 DAC_STREAM_TABLE[DAC_STREAM_MAX_FRAMES * DAC_STREAM_CHANNELS];
+extern void start_dac_stream(BYTE address, uint16 frames, uint16 period, BYTE flags);
+extern void stop_dac_stream();
+extern void dac_stream_tick();
+extern void dac_stream_next();
+extern void fill_dac_ramp(BYTE channel, uint16 start, uint16 stop, uint16 frames);
+
 #endif	/* PSLAB_I2C_H */
 
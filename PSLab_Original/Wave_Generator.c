@@ -2,6 +2,8 @@
 #include "Common_Functions.h"
 #include "Wave_Generator.h"
 #include "PSLAB_ADC.h"
+#include "Measurements.h"
+#include "Function.h"
 
 int __attribute__((section("sine_table1"))) sineTable1[] = {
     256, 252, 249, 246, 243, 240, 237, 234, 230, 227, 224, 221, 218, 215, 212, 209, 206, 203, 200, 196, 193, 190, 187, 184, 181, 178, 175, 172, 169, 166, 164, 161, 158, 155, 152, 149, 146, 143, 141, 138, 135, 132, 130, 127, 124, 121, 119, 116, 114, 111, 108, 106, 103, 101, 98, 96, 93, 91, 89, 86, 84, 82, 79, 77, 75, 73, 70, 68, 66, 64, 62, 60, 58, 56, 54, 52, 50, 48, 47, 45, 43, 41, 40, 38, 36, 35, 33, 32, 30, 29, 27, 26, 25, 23, 22, 21, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 8, 7, 6, 6, 5, 4, 4, 3, 3, 2, 2, 2, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 4, 4, 5, 6, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 29, 30, 32, 33, 35, 36, 38, 40, 41, 43, 45, 47, 48, 50, 52, 54, 56, 58, 60, 62, 64, 66, 68, 70, 73, 75, 77, 79, 82, 84, 86, 89, 91, 93, 96, 98, 101, 103, 106, 108, 111, 114, 116, 119, 121, 124, 127, 130, 132, 135, 138, 141, 143, 146, 149, 152, 155, 158, 161, 164, 166, 169, 172, 175, 178, 181, 184, 187, 190, 193, 196, 200, 203, 206, 209, 212, 215, 218, 221, 224, 227, 230, 234, 237, 240, 243, 246, 249, 252, 256, 259, 262, 265, 268, 271, 274, 277, 281, 284, 287, 290, 293, 296, 299, 302, 305, 308, 311, 315, 318, 321, 324, 327, 330, 333, 336, 339, 342, 345, 347, 350, 353, 356, 359, 362, 365, 368, 370, 373, 376, 379, 381, 384, 387, 390, 392, 395, 397, 400, 403, 405, 408, 410, 413, 415, 418, 420, 422, 425, 427, 429, 432, 434, 436, 438, 441, 443, 445, 447, 449, 451, 453, 455, 457, 459, 461, 463, 464, 466, 468, 470, 471, 473, 475, 476, 478, 479, 481, 482, 484, 485, 486, 488, 489, 490, 492, 493, 494, 495, 496, 497, 498, 499, 500, 501, 502, 503, 503, 504, 505, 505, 506, 507, 507, 508, 508, 509, 509, 509, 510, 510, 510, 511, 511, 511, 511, 511, 511, 511, 511, 511, 511, 511, 510, 510, 510, 509, 509, 509, 508, 508, 507, 507, 506, 505, 505, 504, 503, 503, 502, 501, 500, 499, 498, 497, 496, 495, 494, 493, 492, 490, 489, 488, 486, 485, 484, 482, 481, 479, 478, 476, 475, 473, 471, 470, 468, 466, 464, 463, 461, 459, 457, 455, 453, 451, 449, 447, 445, 443, 441, 438, 436, 434, 432, 429, 427, 425, 422, 420, 418, 415, 413, 410, 408, 405, 403, 400, 397, 395, 392, 390, 387, 384, 381, 379, 376, 373, 370, 368, 365, 362, 359, 356, 353, 350, 347, 345, 342, 339, 336, 333, 330, 327, 324, 321, 318, 315, 311, 308, 305, 302, 299, 296, 293, 290, 287, 284, 281, 277, 274, 271, 268, 265, 262, 259
@@ -20,8 +22,33 @@ int __attribute__((section("sine_table2_short"))) sineTable2_short[] = {
     32, 26, 20, 14, 9, 5, 2, 1, 0, 1, 2, 5, 9, 14, 20, 26, 32, 38, 44, 50, 55, 59, 62, 63, 64, 63, 62, 59, 55, 50, 44, 38
 };
 
+/*-----DDS. Timer4 (sine 1) and Timer3 (sine 2) interrupt at a fixed rate, and the ISR steps a 32 bit phase accumulator-----*/
+BYTE DDS_ACTIVE1 = 0, DDS_ACTIVE2 = 0;
+unsigned long DDS_PHASE1 = 0, DDS_PHASE2 = 0, DDS_TUNING1 = 0, DDS_TUNING2 = 0;
+
+/*-----Live retuning. New periods and compare values wait here until the timer's next period match-----*/
+BYTE RETUNE_SINE1_PENDING = 0, RETUNE_SINE2_PENDING = 0, RETUNE_T1_PENDING = 0;
+BYTE RETUNE_T1_MASK = 0; //bit n : write RETUNE_OC[n] to OC1R,OC1RS,OC2R,...OC4RS
+uint16 RETUNE_PR4 = 0, RETUNE_PR3 = 0, RETUNE_OC4R = 0, RETUNE_PR1 = 0, RETUNE_OC[8];
+
+BYTE PATTERN_STATE = PATTERN_IDLE;
+
+/*-----Played length of the high resolution tables. A power of two up to WAVE_TABLE_FULL_LENGTH-----*/
+uint16 WAVE_LENGTH1 = WAVE_TABLE_FULL_LENGTH, WAVE_LENGTH2 = WAVE_TABLE_FULL_LENGTH;
+BYTE DDS_SHIFT1 = 23, DDS_SHIFT2 = 23; //32 - log2(length). The top bits of the phase index the table
+
+/*-----DDS sweep. The DDS ISR counts down DDS_SWEEP_COUNT samples per step, then moves the tuning word-----*/
+BYTE DDS_SWEEP_CHANNEL = 0, DDS_SWEEP_FLAGS = 0; //channel 0 => no sweep
+uint16 DDS_SWEEP_COUNT = 0, DDS_SWEEP_DWELL = 0, DDS_SWEEP_STEPS = 0, DDS_SWEEP_LEFT = 0;
+unsigned long DDS_SWEEP_START = 0, DDS_SWEEP_STOP = 0, DDS_SWEEP_RATIO = 0;
+long DDS_SWEEP_DELTA = 0;
+unsigned long *DDS_SWEEP_TUNING = &DDS_TUNING1;
+
 void sqr1(uint16 wavelength, uint16 high_time, BYTE scaling) {
     /*-----------------------square wave output-----------------*/
+    _T1IE = 0; //drop a retune still waiting for Timer1, or a stepper move
+    RETUNE_T1_PENDING = 0;
+    STEPPER_STATE = STEPPER_IDLE;
     OC1R = high_time - 1;
     PR1 = wavelength - 1;
 
@@ -29,7 +56,10 @@ void sqr1(uint16 wavelength, uint16 high_time, BYTE scaling) {
     OC1CON1bits.OCTSEL = 4;
     T1CONbits.TCKPS = scaling & 0x3;
     OC1CON2 = 11; //01011 = Timer1 synchronizes or triggers OCx (default)
-    T1CONbits.TON = 1;
+    if (SYNC_HOLD & SYNC_SQR) { //started by SYNC_START
+        T1CONbits.TON = 0;
+        TMR1 = 0;
+    } else T1CONbits.TON = 1;
 
     if ((scaling & 0x4) == 0)RPOR5bits.RP54R = 0x10; //square wave pin(RC6) mapped to 0b010001 (output compare 1 )
     /*-----------------------square wave output-----------------*/
@@ -37,6 +67,7 @@ void sqr1(uint16 wavelength, uint16 high_time, BYTE scaling) {
 
 void sqr2(uint16 wavelength, uint16 high_time, BYTE scaling) {
     /*-----------------------square wave output-----------------*/
+    RETUNE_SINE2_PENDING = 0;
     OC4R = high_time - 1;
     PR3 = wavelength - 1;
     OC4CON1 = 6; //Edge aligned PWM
@@ -60,6 +91,9 @@ void sqr4(uint16 w, uint16 R0, uint16 R1, uint16 RS1, uint16 R2, uint16 RS2, uin
     DMA3CONbits.CHEN = 0;
 
     T1CONbits.TON = 0;
+    _T1IE = 0;
+    RETUNE_T1_PENDING = 0;
+    STEPPER_STATE = STEPPER_IDLE;
     if ((scaling >> 6)&1) {
         EnableComparator();
         OC1CON2 = 0x19;
@@ -114,7 +148,7 @@ void sqr4(uint16 w, uint16 R0, uint16 R1, uint16 RS1, uint16 R2, uint16 RS2, uin
     T1CONbits.TCKPS = scaling & 0x3;
 
     TMR1 = 0;
-    T1CONbits.TON = 1;
+    if (!(SYNC_HOLD & SYNC_SQR))T1CONbits.TON = 1;
 
     RPOR5bits.RP54R = 0x10; //SQR1(RC6) mapped to (output compare 1 )
     RPOR5bits.RP55R = 0x11; //SQR2(RC7) mapped to (output compare 2 )
@@ -125,6 +159,8 @@ void sqr4(uint16 w, uint16 R0, uint16 R1, uint16 RS1, uint16 R2, uint16 RS2, uin
 void sineWave1(uint16 wavelength, BYTE highres) {
     /*-----------------------sine wave output-----------------*/
     T4CONbits.TON = 0;
+    stopDDS(1);
+    stop_pattern();
     _DMA2IF = 0;
     _DMA2IE = 0;
     DMA2CONbits.CHEN = 0;
@@ -152,7 +188,7 @@ void sineWave1(uint16 wavelength, BYTE highres) {
     if (highres & 1) {
         DMA2STAH = __builtin_dmapage(&sineTable1);
         DMA2STAL = __builtin_dmaoffset(&sineTable1);
-        DMA2CNT = WAVE_TABLE_FULL_LENGTH - 1; // total table size -1/  DMA requests
+        DMA2CNT = WAVE_LENGTH1 - 1; // total table size -1/  DMA requests
     } else {
         DMA2STAH = __builtin_dmapage(&sineTable1_short);
         DMA2STAL = __builtin_dmaoffset(&sineTable1_short);
@@ -165,7 +201,8 @@ void sineWave1(uint16 wavelength, BYTE highres) {
 
     T4CONbits.TCKPS = (highres >> 1)&3;
     PR4 = wavelength;
-    T4CONbits.TON = 1;
+    TMR4 = 0;
+    if (!(SYNC_HOLD & SYNC_SINE1))T4CONbits.TON = 1;
 
     RPOR6bits.RP57R = 0x12; //Sine 1 Mapping output to square wave 4 SQR4
 }
@@ -173,6 +210,7 @@ void sineWave1(uint16 wavelength, BYTE highres) {
 void sineWave2(uint16 wavelength, BYTE highres) {
     /*-----------------------sine wave output-----------------*/
     T3CONbits.TON = 0;
+    stopDDS(2);
     T2CONbits.T32 = 0;
     _DMA3IF = 0;
     _DMA3IE = 0;
@@ -200,7 +238,7 @@ void sineWave2(uint16 wavelength, BYTE highres) {
     DMA3REQ = 0b1000; //timer 3 triggers DMA
 
     if (highres & 1) {
-        DMA3CNT = WAVE_TABLE_FULL_LENGTH - 1; // total table size -1/  DMA requests
+        DMA3CNT = WAVE_LENGTH2 - 1; // total table size -1/  DMA requests
         DMA3STAH = __builtin_dmapage(&sineTable2);
         DMA3STAL = __builtin_dmaoffset(&sineTable2);
     } else {
@@ -215,7 +253,8 @@ void sineWave2(uint16 wavelength, BYTE highres) {
 
     T3CONbits.TCKPS = (highres >> 1)&3;
     PR3 = wavelength;
-    T3CONbits.TON = 1;
+    TMR3 = 0;
+    if (!(SYNC_HOLD & SYNC_SINE2))T3CONbits.TON = 1;
 
     RPOR6bits.RP56R = 0x13; //Sine 2 Mapping output to square wave 3 SQR3
 }
@@ -225,6 +264,9 @@ void setSineWaves(uint16 wavelength1, uint16 wavelength2, uint16 pos, uint16 tmr
     T3CONbits.TON = 0;
     T2CONbits.T32 = 0;
     T4CONbits.TON = 0;
+    stopDDS(1);
+    stopDDS(2);
+    stop_pattern();
     _DMA3IF = 0;
     _DMA3IE = 0;
     _DMA2IF = 0;
@@ -274,7 +316,7 @@ void setSineWaves(uint16 wavelength1, uint16 wavelength2, uint16 pos, uint16 tmr
     DMA3REQ = 0b1000; //Timer 3 requests DMA
 
     if (highres & 1) {
-        DMA2CNT = WAVE_TABLE_FULL_LENGTH - 1; // total table size -1/  DMA requests
+        DMA2CNT = WAVE_LENGTH1 - 1; // total table size -1/  DMA requests
         DMA2STAH = __builtin_dmapage(&sineTable1);
         DMA2STAL = __builtin_dmaoffset(&sineTable1);
     } else {
@@ -285,7 +327,7 @@ void setSineWaves(uint16 wavelength1, uint16 wavelength2, uint16 pos, uint16 tmr
 
 
     if (highres & 2) {
-        DMA3CNT = WAVE_TABLE_FULL_LENGTH - 1; // total table size -1/  DMA requests
+        DMA3CNT = WAVE_LENGTH2 - 1; // total table size -1/  DMA requests
         DMA3STAH = __builtin_dmapage(&sineTable2);
         DMA3STAL = __builtin_dmaoffset(&sineTable2);
     } else {
@@ -316,6 +358,311 @@ void setSineWaves(uint16 wavelength1, uint16 wavelength2, uint16 pos, uint16 tmr
     RPOR6bits.RP56R = 0x13; //Sine 2 Mapping output to square wave 3 SQR3
     RPOR6bits.RP57R = 0x12; //Sine 1 Mapping output to square wave 4 SQR4
 
-    T3CONbits.TON = 1;
+    if (!(SYNC_HOLD & SYNC_SINE2))T3CONbits.TON = 1;
+    if (!(SYNC_HOLD & SYNC_SINE1))T4CONbits.TON = 1;
+}
+
+void stopDDS(BYTE channel) {
+    if (DDS_SWEEP_CHANNEL == channel)DDS_SWEEP_CHANNEL = 0;
+    if (channel == 1) {
+        _T4IE = 0;
+        DDS_ACTIVE1 = 0;
+        RETUNE_SINE1_PENDING = 0;
+    } else {
+        _T3IE = 0;
+        DDS_ACTIVE2 = 0;
+        RETUNE_SINE2_PENDING = 0;
+    }
+}
+
+void setDDS(BYTE channel, unsigned long tuning, uint16 phase) {
+    /* f = tuning * (Fcy/DDS_SAMPLE_TICKS) / 2^32. The high resolution table is played without DMA.
+     * phase sets the top 16 bits of the accumulator*/
+    if (DDS_SWEEP_CHANNEL == channel)DDS_SWEEP_CHANNEL = 0;
+    if (channel == 1) {
+        stop_pattern();
+        _T4IE = 0;
+        T4CONbits.TON = 0;
+        _DMA2IE = 0;
+        DMA2CONbits.CHEN = 0;
+        OC3R = HIGH_RES_WAVE >> 1;
+        OC3RS = HIGH_RES_WAVE;
+        OC3CON2 = 0;
+        OC3CON1 = 6; //Edge aligned PWM
+        OC3CON2bits.SYNCSEL = 0x1F; //OCRS compare used for sync
+        OC3CON1bits.OCTSEL = 7; //Fp used as clock
+        DDS_PHASE1 = (unsigned long) phase << 16;
+        DDS_TUNING1 = tuning;
+        DDS_ACTIVE1 = 1;
+        T4CONbits.TCKPS = 0;
+        PR4 = DDS_SAMPLE_TICKS - 1;
+        TMR4 = 0;
+        _T4IP = 5; //above the measurement ISRs, so the sample rate stays fixed
+        _T4IF = 0;
+        _T4IE = 1;
+        if (!(SYNC_HOLD & SYNC_SINE1))T4CONbits.TON = 1;
+        RPOR6bits.RP57R = 0x12; //Sine 1 Mapping output to square wave 4 SQR4
+    } else {
+        _T3IE = 0;
+        T3CONbits.TON = 0;
+        T2CONbits.T32 = 0;
+        _DMA3IE = 0;
+        DMA3CONbits.CHEN = 0;
+        OC4R = HIGH_RES_WAVE >> 1;
+        OC4RS = HIGH_RES_WAVE;
+        OC4CON2 = 0;
+        OC4CON1 = 6; //Edge aligned PWM
+        OC4CON2bits.SYNCSEL = 0x1F; //OCRS compare used for sync
+        OC4CON1bits.OCTSEL = 7; //Fp used as clock
+        DDS_PHASE2 = (unsigned long) phase << 16;
+        DDS_TUNING2 = tuning;
+        DDS_ACTIVE2 = 1;
+        T3CONbits.TCKPS = 0;
+        PR3 = DDS_SAMPLE_TICKS - 1;
+        TMR3 = 0;
+        _T3IP = 5;
+        _T3IF = 0;
+        _T3IE = 1;
+        if (!(SYNC_HOLD & SYNC_SINE2))T3CONbits.TON = 1;
+        RPOR6bits.RP56R = 0x13; //Sine 2 Mapping output to square wave 3 SQR3
+    }
+}
+
+unsigned long long mul_q24(unsigned long long a, unsigned long long b) { //saturates far above any sweep ratio
+    if (a && b > 0xFFFFFFFFFFFFFFFFULL / a)return 1ULL << 58;
+    a = (a * b) >> 24;
+    return a > (1ULL << 58) ? 1ULL << 58 : a;
+}
+
+unsigned long sweep_ratio(unsigned long start, unsigned long stop, uint16 steps) {
+    /* Q24 r with r^steps = stop/start. Bisection, with each power done by repeated squaring*/
+    unsigned long long target = ((unsigned long long) stop << 24) / start, p, base;
+    unsigned long lo = 0, hi = SWEEP_RATIO_MAX, mid;
+    uint16 n;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        p = 1UL << 24;
+        base = mid;
+        for (n = steps; n; n >>= 1) {
+            if (n & 1)p = mul_q24(p, base);
+            base = mul_q24(base, base);
+        }
+        if (p > target)hi = mid;
+        else lo = mid;
+    }
+    return lo;
+}
+
+void setDDSSweep(BYTE channel, unsigned long start, unsigned long stop, uint16 steps, uint16 dwell, BYTE flags) {
+    /* steps tuning words from start to stop, each held for dwell DDS samples. The accumulator is never reset,
+     * so every transition is phase continuous*/
+    setDDS(channel, start, 0);
+    if (channel == 1)_T4IE = 0;
+    else _T3IE = 0;
+    DDS_SWEEP_TUNING = channel == 1 ? &DDS_TUNING1 : &DDS_TUNING2;
+    DDS_SWEEP_START = start;
+    DDS_SWEEP_STOP = stop;
+    DDS_SWEEP_STEPS = steps;
+    DDS_SWEEP_LEFT = steps;
+    DDS_SWEEP_DWELL = dwell;
+    DDS_SWEEP_COUNT = dwell;
+    DDS_SWEEP_FLAGS = flags;
+    if (flags & SWEEP_LOG)DDS_SWEEP_RATIO = sweep_ratio(start, stop, steps - 1);
+    else DDS_SWEEP_DELTA = ((long) (stop - start)) / (long) (steps - 1);
+    if (flags & (SWEEP_SYNC_START | SWEEP_SYNC_STEP)) {
+        RPOR5bits.RP54R = 0; //SQR1 as a plain output
+        _LATC6 = (flags & SWEEP_SYNC_START) ? 1 : 0;
+    }
+    DDS_SWEEP_CHANNEL = steps > 1 ? channel : 0;
+    if (channel == 1)_T4IE = 1;
+    else _T3IE = 1;
+}
+
+void DDSSweepStep() { //called from the DDS ISR when the dwell count runs out
+    DDS_SWEEP_COUNT = DDS_SWEEP_DWELL;
+    if (DDS_SWEEP_FLAGS & SWEEP_SYNC_STEP)_LATC6 ^= 1;
+    else if (DDS_SWEEP_FLAGS & SWEEP_SYNC_START)_LATC6 = 0;
+    if (--DDS_SWEEP_LEFT == 0) {
+        if (!(DDS_SWEEP_FLAGS & SWEEP_REPEAT)) {
+            DDS_SWEEP_CHANNEL = 0; //hold the stop frequency
+            return;
+        }
+        DDS_SWEEP_LEFT = DDS_SWEEP_STEPS;
+        *DDS_SWEEP_TUNING = DDS_SWEEP_START;
+        if (DDS_SWEEP_FLAGS & SWEEP_SYNC_START)_LATC6 = 1;
+    } else if (DDS_SWEEP_LEFT == 1)*DDS_SWEEP_TUNING = DDS_SWEEP_STOP; //no accumulated rounding at the end
+    else if (DDS_SWEEP_FLAGS & SWEEP_LOG) //32x32 bit product fits in 64. sweep_ratio rounds down, so it never passes stop
+        *DDS_SWEEP_TUNING = ((unsigned long long) *DDS_SWEEP_TUNING * DDS_SWEEP_RATIO) >> 24;
+    else *DDS_SWEEP_TUNING += DDS_SWEEP_DELTA;
+}
+
+void setWaveLength(BYTE channel, BYTE bits) { //2^bits entries. Takes effect at the next SET_SINE or SET_DDS
+    if (channel == 1) {
+        WAVE_LENGTH1 = 1 << bits;
+        DDS_SHIFT1 = 32 - bits;
+    } else {
+        WAVE_LENGTH2 = 1 << bits;
+        DDS_SHIFT2 = 32 - bits;
+    }
+}
+
+void generateTable(int *table, uint16 length, uint16 amplitude, BYTE shape, unsigned long param) {
+    /* Fills table[0:length] with values in [0, amplitude], the same scale as the built in sine tables*/
+    uint16 i, phase, seed = param ? param : 0xACE1;
+    unsigned long v = (unsigned long) amplitude << 16;
+    int a, b;
+    for (i = 0; i < length; i++) {
+        phase = ((unsigned long) i << 16) / length; //65536 = one cycle
+        switch (shape) {
+            case WAVE_SINE: //interpolated from the 256 step table. Mid scale and falling, like the built in tables
+                a = sin_q15(phase >> 8);
+                b = sin_q15((phase >> 8) + 1);
+                a += ((long) (b - a) * (phase & 0xFF)) >> 8;
+                table[i] = (amplitude >> 1) - (((long) a * (amplitude >> 1)) >> 15);
+                break;
+            case WAVE_TRIANGLE:
+                table[i] = phase < 32768 ? ((unsigned long) phase * amplitude) >> 15 : ((unsigned long) (65535 - phase) * amplitude) >> 15;
+                break;
+            case WAVE_SAWTOOTH:
+                table[i] = ((unsigned long) phase * amplitude) >> 16;
+                break;
+            case WAVE_SQUARE:
+                table[i] = phase < param ? amplitude : 0;
+                break;
+            case WAVE_EXPONENTIAL:
+                table[i] = v >> 16;
+                v = (v >> 16) * param + (((v & 0xFFFF) * param) >> 16);
+                break;
+            default: //WAVE_NOISE. 16 bit Galois LFSR
+                seed = (seed >> 1) ^ (-(seed & 1) & 0xB400);
+                table[i] = ((unsigned long) seed * (amplitude + 1)) >> 16;
+                break;
+        }
+    }
+}
+
+void retuneSine(BYTE channel, uint16 wavelength) {
+    /* New PR4/PR3 for a DMA driven sine. The timer ISR writes it right after the next period match,
+     * and DMA carries on from the same table entry, so the output stays phase continuous.
+     * If the ISR is late enough for the timer to be past a shorter period, it restarts the period*/
+    if (channel == 1) {
+        _T4IE = 0;
+        RETUNE_PR4 = wavelength;
+        RETUNE_SINE1_PENDING = 1;
+        _T4IF = 0;
+        _T4IE = 1;
+    } else {
+        _T3IE = 0;
+        RETUNE_PR3 = wavelength;
+        RETUNE_SINE2_PENDING = 1;
+        _T3IF = 0;
+        _T3IE = 1;
+    }
+}
+
+void retuneDDS(BYTE channel, unsigned long tuning) { //the accumulator is left alone
+    if (channel == 1) {
+        _T4IE = 0;
+        DDS_TUNING1 = tuning;
+        _T4IE = DDS_ACTIVE1 || RETUNE_SINE1_PENDING;
+    } else {
+        _T3IE = 0;
+        DDS_TUNING2 = tuning;
+        _T3IE = DDS_ACTIVE2 || RETUNE_SINE2_PENDING;
+    }
+}
+
+void retuneSqr2(uint16 wavelength, uint16 high_time) { //same units as sqr2. Applied by the Timer3 ISR
+    _T3IE = 0;
+    RETUNE_PR3 = wavelength - 1;
+    RETUNE_OC4R = high_time - 1;
+    RETUNE_SINE2_PENDING = 2;
+    _T3IF = 0;
+    _T3IE = 1;
+}
+
+void retuneTimer1(uint16 period, BYTE mask) { //RETUNE_OC[] already filled. Applied by the Timer1 ISR
+    _T1IE = 0;
+    RETUNE_PR1 = period;
+    RETUNE_T1_MASK = mask;
+    RETUNE_T1_PENDING = 1;
+    _T1IF = 0;
+    _T1IE = 1;
+}
+
+void applyTimer1Retune() {
+    volatile uint16 *oc[] = {&OC1R, &OC1RS, &OC2R, &OC2RS, &OC3R, &OC3RS, &OC4R, &OC4RS};
+    BYTE n;
+    PR1 = RETUNE_PR1;
+    if (TMR1 >= RETUNE_PR1)TMR1 = 0; //already past the new match
+    for (n = 0; n < 8; n++)if ((RETUNE_T1_MASK >> n)&1)*oc[n] = RETUNE_OC[n];
+    RETUNE_T1_PENDING = 0;
+}
+
+void start_pattern(uint16 length, uint16 period, BYTE prescaler, BYTE pins, BYTE flags, BYTE trigger) {
+    /* Timer4 requests DMA2, which copies ADCbuffer[0:length] to LATC, one word per step. Sine 1 is stopped,
+     * since it uses the same timer and channel.
+     * ADCbuffer holds one state per word, bit 0-3 : SQR1-SQR4 (RC6-RC9). They are turned into complete LATC
+     * words here, so the other PORTC pins (CS1,CS2,...) hold the values they had at the start*/
+    uint16 base, n;
+    stepper_stop(1); //both drive RC6-RC9 through LATC
+    base = LATC & ~0x03C0;
+    T4CONbits.TON = 0;
+    stopDDS(1);
+    _INT2IE = 0;
+    _DMA2IE = 0;
+    DMA2CONbits.CHEN = 0;
+    if (!(flags & PATTERN_REUSE))for (n = 0; n < length; n++)ADCbuffer[n] = base | ((ADCbuffer[n]&0xF) << 6);
+
+    //Pins in the mask are released from the output compare modules and follow LATC
+    if (pins & 1)RPOR5bits.RP54R = 0;
+    if (pins & 2)RPOR5bits.RP55R = 0;
+    if (pins & 4)RPOR6bits.RP56R = 0;
+    if (pins & 8)RPOR6bits.RP57R = 0;
+
+    DMA2CONbits.AMODE = 0; // Register Indirect mode with post-increment
+    DMA2CONbits.SIZE = 0; //word transfer
+    DMA2CONbits.MODE = (flags & PATTERN_LOOP) ? 0 : 1; //Continuous or One-Shot
+    DMA2CONbits.DIR = 1; // RAM-to-Peripheral data transfers
+    DMA2PAD = (volatile uint16) &LATC;
+    DMA2REQ = 0b11011; //timer 4 triggers DMA
+    DMA2STAH = __builtin_dmapage(&ADCbuffer[0]);
+    DMA2STAL = __builtin_dmaoffset(&ADCbuffer[0]);
+    DMA2CNT = length - 1;
+    _DMA2IF = 0;
+    _DMA2IE = !(flags & PATTERN_LOOP); //end of a one shot pattern
+    DMA2CONbits.CHEN = 1;
+
+    T4CONbits.TCKPS = prescaler & 3;
+    PR4 = period - 1;
+    TMR4 = 0;
+    _T4IF = 0;
+    if (trigger & 1) { //[7:4-channel,1-falling edge,0-enable]. Timer4 starts from _INT2Interrupt
+        PATTERN_STATE = PATTERN_ARMED;
+        INTCON2bits.INT2EP = (trigger >> 1)&1;
+        RPINR1bits.INT2R = DIN_REMAPS[(trigger >> 4)&0xF];
+        _INT2IF = 0;
+        _INT2IE = 1;
+    } else release_pattern();
+}
+
+void release_pattern() {
+    PATTERN_STATE = PATTERN_RUNNING;
     T4CONbits.TON = 1;
 }
+
+void pattern_done() { //one shot pattern finished. The pins keep the last state
+    T4CONbits.TON = 0;
+    PATTERN_STATE = PATTERN_DONE;
+}
+
+void stop_pattern() { //called by everything else that takes INT2, Timer4/DMA2 or ADCbuffer
+    if (PATTERN_STATE == PATTERN_IDLE)return;
+    if (PATTERN_STATE == PATTERN_ARMED)_INT2IE = 0;
+    if (DMA2PAD == (volatile uint16) &LATC) {
+        T4CONbits.TON = 0;
+        _DMA2IE = 0;
+        DMA2CONbits.CHEN = 0;
+    }
+    PATTERN_STATE = PATTERN_IDLE;
+}
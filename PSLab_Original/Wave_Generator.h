@@ -13,12 +13,37 @@ extern int __attribute__((section("sine_table2"))) sineTable2[];
 extern int __attribute__((section("sine_table1_short"))) sineTable1_short[];
 extern int __attribute__((section("sine_table2_short"))) sineTable2_short[];
 
+extern BYTE DDS_ACTIVE1, DDS_ACTIVE2;
+extern unsigned long DDS_PHASE1, DDS_PHASE2, DDS_TUNING1, DDS_TUNING2;
+
 extern void sqr1(uint16, uint16, BYTE);
 extern void sqr2(uint16, uint16, BYTE);
 extern void sqr4(uint16 w,uint16 R0,uint16 R1,uint16 RS1,uint16 R2,uint16 RS2,uint16 R3,uint16 RS3,BYTE scaling);
 extern void sineWave1(uint16 wavelength,BYTE highres);
 extern void sineWave2(uint16 wavelength,BYTE highres);
 extern void setSineWaves(uint16 wavelength1,uint16 wavelength2,uint16 pos,uint16 tmr_delay,BYTE highres);
+extern void setDDS(BYTE channel,unsigned long tuning,uint16 phase);
+extern void stopDDS(BYTE channel);
+extern BYTE DDS_SWEEP_CHANNEL;
+extern uint16 WAVE_LENGTH1, WAVE_LENGTH2;
+extern BYTE DDS_SHIFT1, DDS_SHIFT2;
+extern void setWaveLength(BYTE channel,BYTE bits);
+extern BYTE RETUNE_SINE1_PENDING, RETUNE_SINE2_PENDING, RETUNE_T1_PENDING, RETUNE_T1_MASK;
+extern uint16 RETUNE_PR4, RETUNE_PR3, RETUNE_OC4R, RETUNE_PR1, RETUNE_OC[8];
+extern void retuneSine(BYTE channel,uint16 wavelength);
+extern void retuneDDS(BYTE channel,unsigned long tuning);
+extern void retuneSqr2(uint16 wavelength,uint16 high_time);
+extern void retuneTimer1(uint16 period,BYTE mask);
+extern void applyTimer1Retune();
+extern void generateTable(int *table,uint16 length,uint16 amplitude,BYTE shape,unsigned long param);
+extern uint16 DDS_SWEEP_COUNT;
+extern void setDDSSweep(BYTE channel,unsigned long start,unsigned long stop,uint16 steps,uint16 dwell,BYTE flags);
+extern void DDSSweepStep();
+extern BYTE PATTERN_STATE;
+extern void start_pattern(uint16 length, uint16 period, BYTE prescaler, BYTE pins, BYTE flags, BYTE trigger);
+extern void release_pattern();
+extern void pattern_done();
+extern void stop_pattern();
 
 #endif	/* WAVE_GENERATOR_H */
 
@@ -265,6 +265,32 @@ int main() {
                         LEDPIN = 0;
                         break;
 
+                    case CAPTURE_MIXED_SIGNAL: //one analog channel and one digital input on the Timer5 timebase
+                        value = getChar(); //analog channel. bit 7 => 12 bit
+                        samples_to_fetch = getInt();
+                        ADC_DELAY = getInt();
+                        lsb = getInt(); //edges to capture. Two words each
+                        location = getChar(); //digital channel[4 lsb], IC mode[4 msb]
+                        ca = getChar(); //trigger
+                        if (samples_to_fetch > BUFFER_SIZE / 2 || lsb > BUFFER_SIZE / 4 || !samples_to_fetch || !lsb) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        conversion_done = 1;
+                        samples = samples_to_fetch; //DMA capture. Same convention as CAPTURE_DMASPEED
+                        start_mixed_signal(samples_to_fetch, lsb, value, location & 0xF, (location >> 4)&0xF, ca);
+                        LEDPIN = 0;
+                        break;
+
+                    case GET_MIXED_SIGNAL_TIMING:
+                        sendChar(MIXED_SIGNAL_TRIGGERED);
+                        sendInt(MIXED_SIGNAL_TMR5);
+                        sendInt(MIXED_SIGNAL_ICTMR); //skew between timebases = TMR5 - ICTMR
+                        sendInt(ADC_DELAY); //Timer5 ticks per analog sample
+                        sendChar(INITIAL_DIGITAL_STATES);
+                        sendInt(MIXED_SIGNAL_EDGES); //32 bit timestamps stored so far
+                        break;
+
                     case SET_CAP:
                         value = getChar();
                         lsb = getInt(); //Delay uS
@@ -279,6 +305,78 @@ int main() {
                         TRIGGER_PRESCALER = (value >> 4)&0xF;
                         break;
 
+                    case FIT_RC_CURVE: //fit the RC curve left in ADCbuffer by MULTIPOINT_CAPACITANCE or SET_HI/LO_CAPTURE
+                        lsb = getInt(); //first sample
+                        msb = getInt(); //samples. 0 => up to samples_to_fetch
+                        value = getChar(); //1 => 12 bit capture
+                        tmp_int1 = getInt(); //V-infinity in codes. 0xFFFF => estimate from the tail
+                        if (!msb)msb = samples_to_fetch - lsb;
+                        if (lsb + msb > BUFFER_SIZE || lsb + msb < lsb) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        if (DMA0CONbits.CHEN) { //same reply length as a fit
+                            value = FIT_BUSY;
+                            l1 = 0;
+                            tmp_int2 = tmp_int3 = tmp_int4 = tmp_int5 = 0;
+                        } else value = fit_rc_curve(lsb, msb, value ? 4095 : 1023, tmp_int1, &l1, &tmp_int2, &tmp_int3, &tmp_int4, &tmp_int5);
+                        sendChar(value);
+                        sendLong(l1 & 0xFFFF, (l1 >> 16)&0xFFFF); //tau. samples, Q8
+                        sendInt(tmp_int2); //V0
+                        sendInt(tmp_int3); //V-infinity
+                        sendInt(tmp_int4); //mean log2 residual, Q12
+                        sendInt(tmp_int5); //points used
+                        break;
+
+                    case GET_ECHO_DELAY: //locate the echo of the SQR1 burst in a finished PULSE_TRAIN capture
+                        lsb = getInt(); //burst length. uS, as sent with PULSE_TRAIN
+                        msb = getInt(); //first lag
+                        tmp_int1 = getInt(); //last lag. 0 => end of the capture
+                        if (DMA0CONbits.CHEN)value = ECHO_BUSY;
+                        else {
+                            LEDPIN = 0;
+                            value = get_echo_delay(samples_to_fetch, lsb, msb, tmp_int1, (long *) &l1, &tmp_int2);
+                            LEDPIN = 1;
+                        }
+                        if (value != ECHO_OK) {
+                            l1 = 0;
+                            tmp_int2 = 0;
+                        }
+                        sendChar(value);
+                        sendLong(l1 & 0xFFFF, (l1 >> 16)&0xFFFF); //lag. samples, Q8
+                        sendInt(tmp_int2); //score. Q15
+                        break;
+
+                    case GET_BODE: //gain and phase of CH0 against CH1 (the stimulus) at each DDS tuning word, on sine 1
+                        value = getChar(); //channel for CH0
+                        lsb = getInt(); //points
+                        tmp_int1 = getInt(); //stimulus cycles integrated per point
+                        tmp_int2 = getInt(); //stimulus cycles to wait after each retune
+                        if (!lsb || lsb > BODE_MAX_POINTS || !tmp_int1) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        tmp_int3 = BUFFER_SIZE - 2 * lsb; //tuning words, then results, live at the end of ADCbuffer
+                        for (i = 0; i < 2 * lsb; i++)ADCbuffer[tmp_int3 + i] = getInt(); //lsw,msw per point
+                        if (SYNC_HOLD) { //Timer5 or Timer4 would stay stopped until SYNC_START
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        LEDPIN = 0;
+                        if (!DDS_ACTIVE1)setDDS(1, ((unsigned long) ADCbuffer[tmp_int3 + 1] << 16) | (uint16) ADCbuffer[tmp_int3], 0);
+                        for (i = 0; i < lsb; i++) {
+                            l1 = ((unsigned long) ADCbuffer[tmp_int3 + 2 * i + 1] << 16) | (uint16) ADCbuffer[tmp_int3 + 2 * i];
+                            if (!l1 || bode_point(value, l1, tmp_int1, tmp_int2, tmp_int3 / 2, &msb, (int *) &tmp_int4)) {
+                                msb = 0; //gain 0 marks a failed point
+                                tmp_int4 = 0;
+                            }
+                            ADCbuffer[tmp_int3 + 2 * i] = msb;
+                            ADCbuffer[tmp_int3 + 2 * i + 1] = tmp_int4;
+                        }
+                        LEDPIN = 1;
+                        for (i = 0; i < 2 * lsb; i++)sendInt(ADCbuffer[tmp_int3 + i]); //[gain Q12, phase 65536 = 360 degrees]
+                        break;
+
                     case GET_CAPTURE_STATUS:
                         sendChar(conversion_done);
                         sendInt(samples);
@@ -362,6 +460,7 @@ int main() {
                 }
                 break;
             case I2C:
+                stop_dac_stream(); //the foreground owns I2C2 from here
                 switch (sub_command) {
                     case I2C_START: //Initialize I2C and select device address
                         setMultiFuncPortMode(MULTIFUNC_I2C);
@@ -506,6 +605,7 @@ int main() {
                 switch (sub_command) {
 
                     case SET_DAC:
+                        stop_dac_stream();
                         I2C2BRG = 0x90;
                         setMultiFuncPortMode(MULTIFUNC_I2C);
                         location = getChar(); //=address<<1 | R/W   [r=1,w=0]
@@ -519,6 +619,50 @@ int main() {
                         I2CStop();
                         Delay_us(6);
                         break;
+                    case LOAD_DAC_STREAM: //frames of 4 words, channel A-D
+                        lsb = getInt(); //first frame
+                        msb = getInt(); //frames
+                        if (lsb + msb > DAC_STREAM_MAX_FRAMES || lsb + msb < lsb) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        for (i = lsb * DAC_STREAM_CHANNELS; i < (lsb + msb) * DAC_STREAM_CHANNELS; i++)DAC_STREAM_TABLE[i] = getInt();
+                        break;
+
+                    case START_DAC_STREAM: //frames loaded with LOAD_DAC_STREAM or FILL_DAC_RAMP
+                        location = getChar(); //=address<<1 | R/W   [r=1,w=0]
+                        lsb = getInt(); //frames
+                        msb = getInt(); //period, uS
+                        value = getChar(); //flags
+                        if (lsb == 0 || lsb > DAC_STREAM_MAX_FRAMES || msb < DAC_STREAM_MIN_PERIOD) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        start_dac_stream(location, lsb, msb, value);
+                        break;
+
+                    case STOP_DAC_STREAM:
+                        stop_dac_stream();
+                        break;
+
+                    case GET_DAC_STREAM_STATUS:
+                        sendChar(DAC_STREAM_STATE);
+                        sendInt(DAC_STREAM_FRAME);
+                        sendInt(DAC_STREAM_LATE); //frames skipped because the bus was still busy
+                        break;
+
+                    case FILL_DAC_RAMP: //linear ramp into one channel of the stream table
+                        value = getChar(); //DAC channel 0-3
+                        lsb = getInt(); //start
+                        msb = getInt(); //stop
+                        tmp_int1 = getInt(); //frames
+                        if (value >= DAC_STREAM_CHANNELS || tmp_int1 == 0 || tmp_int1 > DAC_STREAM_MAX_FRAMES) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        fill_dac_ramp(value, lsb, msb, tmp_int1);
+                        break;
+
                     case SET_CALIBRATED_DAC: // removed. All calibration is applied on the Python Side, and this is unnecessary
                         location = getChar(); //=address << 1 | R/W   [r=1,w=0]
                         value = getChar(); //=DAC channel 0-3
@@ -551,6 +695,84 @@ int main() {
                         setSineWaves(tmp_int1, tmp_int2, lsb, msb, value);
                         break;
 
+                    case SET_DDS: //phase accumulator output. SET_SINE1/2 and SET_WG_PHASE return to the DMA tables
+                        value = getChar(); //1 => sine 1, 2 => sine 2
+                        lsb = getInt();
+                        msb = getInt(); //tuning word. lsw,msw
+                        tmp_int1 = getInt(); //start phase. 65536 = 360 degrees
+                        if (value != 1 && value != 2) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        setDDS(value, ((unsigned long) msb << 16) | lsb, tmp_int1);
+                        break;
+
+                    case SET_DDS_SWEEP: //autonomous DDS sweep. Tuning words as in SET_DDS
+                        value = getChar(); //channel[4 lsb], SWEEP_ flags[4 msb]
+                        lsb = getInt();
+                        msb = getInt(); //start tuning word
+                        tmp_int1 = getInt();
+                        tmp_int2 = getInt(); //stop tuning word
+                        tmp_int3 = getInt(); //steps
+                        tmp_int4 = getInt(); //dwell per step in DDS samples (20uS). sweep time = steps*dwell
+                        l1 = ((unsigned long) msb << 16) | lsb;
+                        l2 = ((unsigned long) tmp_int2 << 16) | tmp_int1;
+                        if (((value & 0xF) != 1 && (value & 0xF) != 2) || tmp_int3 < 2 || !tmp_int4 || (((value >> 4) & SWEEP_LOG) && (!l1 || !l2))) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        setDDSSweep(value & 0xF, l1, l2, tmp_int3, tmp_int4, value >> 4);
+                        break;
+
+                    case SET_WAVE_LENGTH: //play only the first 2^n high resolution entries
+                        value = getChar(); //channel
+                        location = getChar(); //n. 5 to 9
+                        if ((value != 1 && value != 2) || location < 5 || location > WAVE_TABLE_FULL_BITS) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        setWaveLength(value, location);
+                        break;
+
+                    case LOAD_WAVE_SEGMENT: //overwrite part of a live table
+                        value = getChar(); //channel[4 lsb]. bit 7 => short table
+                        lsb = getInt(); //first entry
+                        msb = getInt(); //entries
+                        tmp_int1 = (value & 0x80) ? WAVE_TABLE_SHORT_LENGTH : WAVE_TABLE_FULL_LENGTH;
+                        if (((value & 0xF) != 1 && (value & 0xF) != 2) || lsb + msb > tmp_int1 || lsb + msb < lsb) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        for (i = 0; i < msb; i++) {
+                            if (value & 0x80) {
+                                if ((value & 0xF) == 1)sineTable1_short[lsb + i] = getChar();
+                                else sineTable2_short[lsb + i] = getChar();
+                            } else {
+                                if ((value & 0xF) == 1)sineTable1[lsb + i] = getInt();
+                                else sineTable2[lsb + i] = getInt();
+                            }
+                        }
+                        break;
+
+                    case GENERATE_WAVEFORM: //build both tables of a channel from a few parameters
+                        value = getChar(); //channel
+                        location = getChar(); //WAVE_ shape
+                        lsb = getInt();
+                        msb = getInt(); //parameter. lsw,msw
+                        if ((value != 1 && value != 2) || location > WAVE_NOISE) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        l1 = ((unsigned long) msb << 16) | lsb;
+                        if (value == 1) {
+                            generateTable(sineTable1, WAVE_LENGTH1, HIGH_RES_WAVE, location, l1);
+                            generateTable(sineTable1_short, WAVE_TABLE_SHORT_LENGTH, LOW_RES_WAVE, location, l1);
+                        } else {
+                            generateTable(sineTable2, WAVE_LENGTH2, HIGH_RES_WAVE, location, l1);
+                            generateTable(sineTable2_short, WAVE_TABLE_SHORT_LENGTH, LOW_RES_WAVE, location, l1);
+                        }
+                        break;
+
                     case LOAD_WAVEFORM1:
                         for (lsb = 0; lsb < WAVE_TABLE_FULL_LENGTH; lsb++)sineTable1[lsb] = getInt();
                         for (lsb = 0; lsb < WAVE_TABLE_SHORT_LENGTH; lsb++)sineTable1_short[lsb] = getChar();
@@ -590,6 +812,73 @@ int main() {
                         sqr4(lsb, msb, tmp_int1, tmp_int2, tmp_int3, tmp_int4, tmp_int5, tmp_int6, value);
                         break;
 
+                    case RETUNE_SINE: //new timer period for a running SET_SINE1/2 output, without a restart
+                        value = getChar(); //channel
+                        lsb = getInt(); //wavelength, as in SET_SINE1/2
+                        if ((value != 1 && value != 2) || (value == 1 ? DDS_ACTIVE1 : DDS_ACTIVE2)) {
+                            RESPONSE = ARGUMENT_ERROR; //a DDS output is retuned with RETUNE_DDS
+                            break;
+                        }
+                        retuneSine(value, lsb);
+                        break;
+
+                    case RETUNE_DDS: //new tuning word for a running SET_DDS output
+                        value = getChar(); //channel
+                        lsb = getInt();
+                        msb = getInt(); //tuning word. lsw,msw
+                        if (value != 1 && value != 2) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        retuneDDS(value, ((unsigned long) msb << 16) | lsb);
+                        break;
+
+                    case RETUNE_SQR1: //as SET_SQR1, applied at the next Timer1 period. Prescaler unchanged
+                        lsb = getInt(); //wavelength
+                        msb = getInt(); //high time
+                        if (STEPPER_STATE != STEPPER_IDLE) {
+                            RESPONSE = ARGUMENT_ERROR; //Timer1 is pacing the stepper
+                            break;
+                        }
+                        RETUNE_OC[0] = msb - 1;
+                        retuneTimer1(lsb - 1, 0x01);
+                        break;
+
+                    case RETUNE_SQR2: //as SET_SQR2, applied at the next Timer3 period. Prescaler unchanged
+                        lsb = getInt(); //wavelength
+                        msb = getInt(); //high time
+                        retuneSqr2(lsb, msb);
+                        break;
+
+                    case RETUNE_SQR4: //as SQR4, applied at the next Timer1 period. Modes and prescaler unchanged
+                        lsb = getInt(); //wavelength
+                        RETUNE_OC[0] = 0;
+                        RETUNE_OC[1] = getInt(); //high time 0
+                        for (i = 2; i < 8; i++)RETUNE_OC[i] = getInt(); //[high time, phase] 1-3
+                        if (STEPPER_STATE != STEPPER_IDLE) {
+                            RESPONSE = ARGUMENT_ERROR; //Timer1 is pacing the stepper
+                            break;
+                        }
+                        retuneTimer1(lsb, 0xFF);
+                        break;
+
+                    case SAVE_WAVE_PRESET: //store the tables of a channel in a flash slot
+                        location = getChar(); //slot
+                        value = getChar(); //channel
+                        if (location >= WAVE_PRESET_SLOTS || (value != 1 && value != 2)) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        save_wave_preset(location, value);
+                        break;
+
+                    case RECALL_WAVE_PRESET: //copy a flash slot into the tables of a channel
+                        location = getChar(); //slot
+                        value = getChar(); //channel
+                        if (location >= WAVE_PRESET_SLOTS || (value != 1 && value != 2)
+                                || !recall_wave_preset(location, value))RESPONSE = ARGUMENT_ERROR;
+                        break;
+
                     case MAP_REFERENCE:
                         location = getChar();
                         value = getChar();
@@ -613,6 +902,60 @@ int main() {
                         LATC |= ((lsb & 0x000F) << 6); //set the bits specified in the data(4LSB of data)
                         break;
 
+                    case START_PATTERN: //states already in ADCbuffer (FILL_BUFFER). bit 0-3 : SQR1-SQR4
+                        lsb = getInt(); //steps
+                        msb = getInt(); //Timer4 ticks per step
+                        value = getChar(); //[7:4 pin mask, 3:2 flags, 1:0 prescaler]
+                        location = getChar(); //trigger. [7:4-channel,1-falling edge,0-enable]
+                        if (lsb == 0 || lsb > BUFFER_SIZE || msb < PATTERN_MIN_PERIOD) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        start_pattern(lsb, msb, value & 3, value >> 4, (value >> 2)&3, location);
+                        break;
+
+                    case STOP_PATTERN:
+                        stop_pattern();
+                        break;
+
+                    case GET_PATTERN_STATUS:
+                        sendChar(PATTERN_STATE);
+                        break;
+
+                    case STEPPER_MOVE: //absolute target, trapezoidal speed profile
+                        lsb = getInt();
+                        msb = getInt(); //target position. lsw,msw
+                        tmp_int1 = getInt(); //maximum speed, steps/s
+                        tmp_int2 = getInt(); //acceleration, steps/s^2. 0 : no ramp
+                        value = getChar(); //flags
+                        if (tmp_int1 == 0 || !stepper_move((long) (((unsigned long) msb << 16) | lsb), tmp_int1, tmp_int2, value))
+                            RESPONSE = ARGUMENT_ERROR;
+                        break;
+
+                    case STEPPER_STOP:
+                        value = getChar(); //0 : ramp down , 1 : halt
+                        stepper_stop(value);
+                        break;
+
+                    case STEPPER_STATUS:
+                        value = _T1IE;
+                        _T1IE = 0; //the ISR must not step between the two halves
+                        l1 = STEPPER_POSITION;
+                        l2 = STEPPER_SPEED;
+                        ca = STEPPER_STATE;
+                        _T1IE = value;
+                        sendChar(ca);
+                        sendLong(l1 & 0xFFFF, (l1 >> 16)&0xFFFF);
+                        sendInt(((unsigned long long) l2 * STEPPER_TICK_HZ) >> 24); //steps/s
+                        break;
+
+                    case STEPPER_SET_POSITION: //redefine the present position, while idle
+                        lsb = getInt();
+                        msb = getInt();
+                        if (STEPPER_STATE != STEPPER_IDLE)RESPONSE = ARGUMENT_ERROR;
+                        else STEPPER_POSITION = (long) (((unsigned long) msb << 16) | lsb);
+                        break;
+
                 }
                 break;
             case DIN:
@@ -685,6 +1028,113 @@ int main() {
                         break;
 
 
+                    case START_TIMING_JOB: //Same arguments as the blocking command, preceded by the job type
+                        cc = getChar();
+                        lsb = getInt(); //timeout. [t(s)*64e6>>16]
+                        switch (cc) {
+                            case TIMING_JOB_TIMING:
+                                value = getChar();
+                                location = getChar();
+                                init_IC_for_frequency(location & 0xF, (value >> 2)&0x7, value & 0x3);
+                                start_timing_job(cc, lsb, value & 0x3, 0);
+                                break;
+                            case TIMING_JOB_MEASUREMENTS:
+                                location = getChar();
+                                value = getChar();
+                                cb = getChar();
+                                TimingMeasurements(location & 0xF, (location >> 4)&0xF, value & 0x7, (value >> 3)&0x7, cb & 0xF, (cb >> 4)&0xF);
+                                if ((value >> 6)&1) {
+                                    RPOR5bits.RP54R = 0;
+                                    _LATC6 = (value >> 7)&1;
+                                }
+                                start_timing_job(cc, lsb, cb & 0xF, (cb >> 4)&0xF);
+                                break;
+                            case TIMING_JOB_INTERVAL:
+                                location = getChar();
+                                value = getChar();
+                                Interval(location & 0xF, (location >> 4)&0xF, value & 0x7, (value >> 3)&0x7);
+                                start_timing_job(cc, lsb, 1, 1);
+                                break;
+                            case TIMING_JOB_FREQUENCY:
+                                value = getChar();
+                                init_IC_for_frequency(value, EVERY_SIXTEENTH_RISING_EDGE, 2);
+                                start_timing_job(cc, lsb, 2, 0);
+                                break;
+                            case TIMING_JOB_HCSR04:
+                                RPOR5bits.RP54R = 0;
+                                _LATC6 = 1; //SQR1  high
+                                Interval(0, 0, 3, 2);
+                                start_timing_job(cc, lsb, 1, 1);
+                                Delay_us(10);
+                                _LATC6 = 0; //SQR1 low
+                                break;
+                            default:
+                                RESPONSE = ARGUMENT_ERROR;
+                                break;
+                        }
+                        break;
+
+                    case FETCH_TIMING_JOB: //[2-timeout,1-done] (+4 on overflow). 0 => still running
+                        value = timing_job_status();
+                        sendChar(value);
+                        if (value == TIMING_JOB_BUSY)break;
+                        for (n = 0; n < 2 * (TIMING_JOB_PAIRS1 + TIMING_JOB_PAIRS2); n++)sendInt(TIMING_JOB_DATA[n]);
+                        sendInt(TIMING_JOB_TMR);
+                        TIMING_JOB = TIMING_JOB_NONE;
+                        TIMING_JOB_PAIRS1 = 0;
+                        TIMING_JOB_PAIRS2 = 0;
+                        break;
+
+                    case START_PHASE_MONITOR: //pairs every pin 1 edge with the next pin 2 edge until stopped
+                        location = getChar(); //pin1[4 lsb], pin2[4 msb]
+                        value = getChar(); //pin1 edge[3 lsb], pin2 edge[next 3]
+                        start_phase_monitor(location & 0xF, (location >> 4)&0xF, value & 0x7, (value >> 3)&0x7);
+                        break;
+
+                    case STOP_PHASE_MONITOR:
+                        stop_phase_monitor();
+                        break;
+
+                    case FETCH_PHASE_MONITOR: //statistics, then the oldest unread [delay, phase] records
+                        lsb = getInt(); //max records to fetch
+                        _IC1IE = 0;
+                        _IC3IE = 0;
+                        msb = PHASE_MONITOR_WRITE >= PHASE_MONITOR_READ ? PHASE_MONITOR_WRITE - PHASE_MONITOR_READ : PHASE_MONITOR_LENGTH - PHASE_MONITOR_READ + PHASE_MONITOR_WRITE;
+                        if (msb > lsb)msb = lsb;
+                        tmp_int2 = PHASE_MONITOR_READ; //local read index
+                        tmp_int3 = PHASE_MONITOR_SEQ;
+                        sendChar(PHASE_MONITOR_OVERRUN);
+                        sendInt(tmp_int3);
+                        sendInt(msb);
+                        l1 = PHASE_MONITOR_COUNT ? PHASE_MONITOR_DELAY_SUM / PHASE_MONITOR_COUNT : 0; //mean delay
+                        l2 = PHASE_MONITOR_COUNT ? PHASE_MONITOR_PERIOD_SUM / PHASE_MONITOR_COUNT : 0; //mean period
+                        sendLong(PHASE_MONITOR_COUNT & 0xFFFF, PHASE_MONITOR_COUNT >> 16);
+                        sendLong(PHASE_MONITOR_MIN & 0xFFFF, PHASE_MONITOR_MIN >> 16);
+                        sendLong(PHASE_MONITOR_MAX & 0xFFFF, PHASE_MONITOR_MAX >> 16);
+                        PHASE_MONITOR_OVERRUN = 0;
+                        _IC1IE = PHASE_MONITOR_RUNNING;
+                        _IC3IE = PHASE_MONITOR_RUNNING;
+                        sendLong(l1 & 0xFFFF, l1 >> 16);
+                        sendLong(l2 & 0xFFFF, l2 >> 16);
+                        sendInt(phase_of(l1, l2)); //mean phase
+                        for (i = 0; i < msb; i++) {
+                            l1 = (uint16) ADCbuffer[4 * tmp_int2] | ((unsigned long) (uint16) ADCbuffer[4 * tmp_int2 + 1] << 16);
+                            l2 = (uint16) ADCbuffer[4 * tmp_int2 + 2] | ((unsigned long) (uint16) ADCbuffer[4 * tmp_int2 + 3] << 16);
+                            sendLong(l1 & 0xFFFF, l1 >> 16); //delay in Fp ticks
+                            sendInt(phase_of(l1, l2));
+                            tmp_int2++;
+                            if (tmp_int2 == PHASE_MONITOR_LENGTH)tmp_int2 = 0;
+                        }
+                        _IC1IE = 0;
+                        _IC3IE = 0;
+                        if ((uint16) (PHASE_MONITOR_SEQ - tmp_int3) < msb) { //unless the ISR already dropped past them
+                            PHASE_MONITOR_READ = tmp_int2;
+                            PHASE_MONITOR_SEQ = tmp_int3 + msb;
+                        }
+                        _IC1IE = PHASE_MONITOR_RUNNING;
+                        _IC3IE = PHASE_MONITOR_RUNNING;
+                        break;
+
                     case CONFIGURE_COMPARATOR:
                         COMPARATOR_CONFIG = getChar();
                         break;
@@ -703,6 +1153,9 @@ int main() {
                             _INT2IF = 0;
                             _INT2IE = 1;
 
+                        } else if (LA_TRIGGER_STAGES) {
+                            start_1chan_LA(lsb, (ca >> 4)&0xF, ca & 0xF, 0);
+                            arm_LA_trigger();
                         } else {
                             start_1chan_LA(lsb, (ca >> 4)&0xF, ca & 0xF, 0);
                             INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4); //INITIAL_DIGITAL_STATES =(PORTB>>10)&0xF;
@@ -725,6 +1178,9 @@ int main() {
                             _IC4IF = 0;
                             _IC4IP = 7;
                             _IC4IE = 1; //enable input capture interrupt. highest priority
+                        } else if (LA_TRIGGER_STAGES) {
+                            start_1chan_LA(lsb, (value >> 4)&0xF, (value)&0xF, 0);
+                            arm_LA_trigger();
                         } else {
                             start_1chan_LA(lsb, (value >> 4)&0xF, (value)&0xF, 0);
                             INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4); //INITIAL_DIGITAL_STATES =(PORTB>>10)&0xF;
@@ -755,6 +1211,10 @@ int main() {
                             IC2CON1bits.ICM = LAM2;
                             IC3CON1bits.ICM = LAM3;
                             IC4CON1bits.ICM = LAM4;
+                            if (LA_TRIGGER_STAGES) {
+                                arm_LA_trigger();
+                                break;
+                            }
                             INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4); //INITIAL_DIGITAL_STATES =(PORTB>>10)&0xF;
                             IC1CON2bits.TRIGSTAT = 1;
                             IC3CON2bits.TRIGSTAT = 1;
@@ -774,6 +1234,9 @@ int main() {
                             _IC4IF = 0;
                             _IC4IP = 7;
                             _IC4IE = 1; //enable input capture interrupt. highest priority
+                        } else if (LA_TRIGGER_STAGES) {
+                            start_3chan_LA(lsb, msb & 0x0FFF, 0);
+                            arm_LA_trigger();
                         } else {
                             start_3chan_LA(lsb, msb & 0x0FFF, 0);
                             b1 = PORTB;
@@ -811,6 +1274,8 @@ int main() {
                             }//enable level change interrupt on B12(ID3)
                             _CNIF = 0;
                             _CNIE = 1;
+                        } else if (LA_TRIGGER_STAGES) {
+                            arm_LA_trigger(); //starts Timer2
                         } else {
                             T2CONbits.TON = 1; // Start Timer
                             INITIAL_DIGITAL_STATES = ((PORTB >> 10)&0xF) | (_C4OUT << 4); //INITIAL_DIGITAL_STATES =(PORTB>>10)&0xF;
@@ -823,9 +1288,37 @@ int main() {
                         break;
 
                     case STOP_LA: //
+                        disarm_LA_trigger();
                         disable_input_capture();
                         break;
 
+                    case CONFIGURE_LA_TRIGGER: //Staged pattern/edge trigger used by the untriggered LA start commands
+                        value = getChar(); //number of stages. 0 disables the engine
+                        if (value > LA_TRIGGER_MAX_STAGES) { //drain the stages and the window. Keep the old trigger
+                            for (n = 0; n < 3 * value; n++)getChar();
+                            getInt();
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        ca = 0;
+                        for (n = 0; n < 3 * value; n++) { //[mask, value, edge] per stage, staged in data[]
+                            data[n] = getChar();
+                            if (n % 3 == 2 && (data[n] & LA_TRIGGER_EDGE_CHANNEL) > 4)ca = 1; //C4OUT has no CN interrupt
+                        }
+                        lsb = getInt(); //max Timer2 ticks between stages
+                        if (ca) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        for (n = 0; n < value; n++) {
+                            LA_TRIGGER_MASK[n] = data[3 * n]; //[4-C4OUT,3-ID4,2-ID3,1-ID2,0-ID1]
+                            LA_TRIGGER_VALUE[n] = data[3 * n + 1];
+                            LA_TRIGGER_EDGE[n] = data[3 * n + 2]; //[3-falling,2:0-channel 1-4, 0=pattern only]
+                        }
+                        LA_TRIGGER_WINDOW = lsb;
+                        LA_TRIGGER_STAGES = value;
+                        break;
+
                     case GET_INITIAL_DIGITAL_STATES: //Using input capture
                         sendInt(__builtin_dmaoffset(&ADCbuffer));
                         sendInt(DMA0STAL);
@@ -836,6 +1329,42 @@ int main() {
                         sendChar(INITIAL_DIGITAL_STATES_ERR);
                         break;
 
+                    case GET_LA_PROGRESS: //valid edges so far, per DMA channel. Poll this instead of waiting out a timeout
+                        sendChar(LA_TRIGGER_STAGE);
+                        sendInt(LASamples);
+                        for (value = 0; value < 4; value++) {
+                            sendInt(LA_write_index(value));
+                            ca = 0;
+                            if (value == 0) {
+                                ca = DMA0CONbits.CHEN | (IC1CON1bits.ICOV << 1) | (IC1CON2bits.TRIGSTAT << 2);
+                            } else if (value == 1) {
+                                ca = DMA1CONbits.CHEN | (IC2CON1bits.ICOV << 1) | (IC2CON2bits.TRIGSTAT << 2);
+                            } else if (value == 2) {
+                                ca = DMA2CONbits.CHEN | (IC3CON1bits.ICOV << 1) | (IC3CON2bits.TRIGSTAT << 2);
+                            } else {
+                                ca = DMA3CONbits.CHEN | (IC4CON1bits.ICOV << 1) | (IC4CON2bits.TRIGSTAT << 2);
+                            }
+                            if (LA_SCAN_POS[value] >= LASamples)ca |= 8; //complete
+                            if (!LA_BUFFERS_MARKED)ca |= 16; //index not tracked. See SET_LA_PROGRESS
+                            sendChar(ca); //[4-untracked,3-complete,2-triggered,1-overflow,0-DMA running]
+                        }
+                        break;
+
+                    case SET_LA_PROGRESS: //1 : mark the buffers at the next LA start, so GET_LA_PROGRESS can report write indices
+                        LA_PROGRESS_TRACKING = getChar();
+                        break;
+
+                    case FETCH_LA_WRAPS: //Timer2 wrap table for 32 bit timestamps in the four channel LA
+                        sendInt(LA_WRAPS);
+                        for (value = 0; value < 4; value++) {
+                            sendChar(LA_WRAP_ENTRIES[value]);
+                            for (n = 0; n < LA_WRAP_ENTRIES[value]; n++) {
+                                sendInt(LA_WRAP_INDEX[value][n]);
+                                sendInt(LA_WRAP_EPOCH[value][n]);
+                            }
+                        }
+                        break;
+
                     case FETCH_LONG_DMA_DATA: //Using input capture
                         lsb = getInt(); //Bytes to get
                         value = getChar(); //channel number
@@ -867,6 +1396,24 @@ int main() {
                         sendInt(msb);
                         break;
 
+                    case GET_CTMU_SWEEP: //GET_CTMU_VOLTAGE over a list of current settings. One summed reading per step
+                        value = getChar(); //bits<0-4> = channel, bit 7 = TGEN
+                        lsb = getInt(); //steps. 0 => every IRNG, ITRIM combination
+                        if (lsb > CTMU_SWEEP_MAX) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        if (lsb)for (i = 0; i < lsb; i++)ADCbuffer[i] = getChar(); //[IRNG(2 msb) | ITRIM(6 lsb)]
+                        else {
+                            lsb = CTMU_SWEEP_MAX;
+                            for (i = 0; i < lsb; i++)ADCbuffer[i] = i;
+                        }
+                        LEDPIN = 0;
+                        ctmu_sweep(value & 0x1F, (value >> 7)&0x1, &ADCbuffer[0], lsb, &ADCbuffer[CTMU_SWEEP_MAX]);
+                        LEDPIN = 1;
+                        for (i = 0; i < lsb; i++)sendInt(ADCbuffer[CTMU_SWEEP_MAX + i]);
+                        break;
+
                     case GET_CAP_RANGE:
                         msb = getInt(); //Charge time.  microseconds
                         sendInt(get_cap_range(msb));
@@ -899,6 +1446,17 @@ int main() {
                         LEDPIN = 1;
                         break;
 
+                    case GET_CAPACITANCE_AUTORANGE: //ranging loop on the device. [attempts (0 = out of window), range, charge time, reading]
+                        location = getChar(); //current trimming bits
+                        LEDPIN = 0;
+                        value = get_capacitance_autorange(location, &ca, &lsb, &msb);
+                        LEDPIN = 1;
+                        sendChar(value);
+                        sendChar(ca);
+                        sendInt(lsb);
+                        sendInt(msb);
+                        break;
+
                     case START_COUNTING: // Need to count the number of Skittles in a packet? Make a light barrier, connect the output to the digital input , and start pouring them throught the barrier!
                         location = getChar(); //Channel
                         startCounting(location);
@@ -920,6 +1478,116 @@ int main() {
                         sendLong(freq_lsb, freq_msb);
                         break;
 
+                    case GET_RECIPROCAL_FREQUENCY: //Shares TIMER5 with the ADC, and the LA buffers. f = 64MHz * edges / elapsed
+                        LEDPIN = 0;
+                        value = getChar(); //channel[4 lsb], capture mode[4 msb]
+                        lsb = getInt(); //gate. Timer5 ticks at 1:256 (4uS)
+                        i = get_reciprocal_frequency(value & 0xF, (value >> 4)&0xF, lsb, &l1, &l2);
+                        LEDPIN = 1;
+                        sendInt(i); //captures
+                        sendLong(l1 & 0xFFFF, (l1 >> 16)&0xFFFF); //edges
+                        sendLong(l2 & 0xFFFF, (l2 >> 16)&0xFFFF); //elapsed Fp cycles
+                        break;
+
+                    case START_FREQUENCY_MONITOR: //Background readings every gate. Owns TIMER5 and Timer2/3 until stopped
+                        value = getChar(); //channel[4 lsb], scaling[4 msb]
+                        lsb = getInt(); //gate. Timer5 ticks at 1:256 (4uS)
+                        start_frequency_monitor(value & 0xF, (value >> 4)&0x4, lsb);
+                        break;
+
+                    case STOP_FREQUENCY_MONITOR:
+                        stop_frequency_monitor();
+                        break;
+
+                    case FETCH_FREQUENCY_MONITOR: //oldest unread readings first
+                        lsb = getInt(); //max readings to fetch
+                        _T5IE = 0;
+                        msb = FREQ_MONITOR_WRITE >= FREQ_MONITOR_READ ? FREQ_MONITOR_WRITE - FREQ_MONITOR_READ : FREQ_MONITOR_LENGTH - FREQ_MONITOR_READ + FREQ_MONITOR_WRITE;
+                        if (msb > lsb)msb = lsb;
+                        tmp_int2 = FREQ_MONITOR_READ; //local read index
+                        tmp_int3 = FREQ_MONITOR_SEQ;
+                        ca = FREQ_MONITOR_OVERRUN;
+                        FREQ_MONITOR_OVERRUN = 0;
+                        _T5IE = FREQ_MONITOR_RUNNING;
+                        sendChar(ca);
+                        sendInt(tmp_int3); //sequence number of the first reading. time = seq*gate
+                        sendInt(msb);
+                        for (i = 0; i < msb; i++) {
+                            sendLong(ADCbuffer[2 * tmp_int2], ADCbuffer[2 * tmp_int2 + 1]);
+                            tmp_int2++;
+                            if (tmp_int2 == FREQ_MONITOR_LENGTH)tmp_int2 = 0;
+                        }
+                        _T5IE = 0;
+                        if ((uint16) (FREQ_MONITOR_SEQ - tmp_int3) < msb) { //unless the ISR already dropped past them
+                            FREQ_MONITOR_READ = tmp_int2;
+                            FREQ_MONITOR_SEQ = tmp_int3 + msb;
+                        }
+                        _T5IE = FREQ_MONITOR_RUNNING;
+                        break;
+
+                    case GET_MULTI_FREQUENCY: //period and high time on up to four inputs at once. Owns Timer2 and IC1-IC4
+                        value = getChar(); //channel count[3 lsb], timer2 prescaler[2 msb]
+                        n = value & 0x7;
+                        for (i = 0; i < n; i++) { //read every input byte sent, even past the four supported
+                            ca = getChar();
+                            if (i < 4)MULTI_FREQ_INPUTS[i] = ca;
+                        }
+                        lsb = getInt(); //timeout in Timer2 rollovers
+                        if (n < 1 || n > 4) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        for (i = 0; i < n; i++)if (MULTI_FREQ_INPUTS[i] > 4)RESPONSE = ARGUMENT_ERROR; //edge polarity known for ID1-4 and COMP4 only
+                        if (RESPONSE == ARGUMENT_ERROR)break;
+                        LEDPIN = 0;
+                        start_multi_frequency(n, value >> 6);
+                        msb = 0;
+                        while (MULTI_FREQ_DONE != MULTI_FREQ_CHANNELS && msb < lsb) {
+                            asm("CLRWDT"); //the timeout can outlast the watchdog
+                            if (_T2IF) {
+                                _T2IF = 0;
+                                msb++;
+                            }
+                        }
+                        stop_multi_frequency();
+                        LEDPIN = 1;
+                        sendChar(MULTI_FREQ_DONE); //bit n set : channel n measured
+                        for (i = 0; i < n; i++) {
+                            if (!(MULTI_FREQ_DONE & (1 << i))) {
+                                sendInt(0);
+                                sendInt(0);
+                                continue;
+                            }
+                            sendInt(MULTI_FREQ_DATA[i][2] - MULTI_FREQ_DATA[i][0]); //period
+                            if (MULTI_FREQ_STATES & (1 << i))sendInt(MULTI_FREQ_DATA[i][2] - MULTI_FREQ_DATA[i][1]); //first edge was falling
+                            else sendInt(MULTI_FREQ_DATA[i][1] - MULTI_FREQ_DATA[i][0]); //high time
+                        }
+                        break;
+
+                    case GET_TIMING_HISTOGRAM: //histogram of periods or pulse widths on one channel, in Fp ticks
+                        value = getChar(); //channel[4 lsb], mode[4 msb]
+                        lsb = getInt(); //samples
+                        l1 = getInt();
+                        l2 = getInt(); //origin. lsw,msw
+                        ca = getChar(); //bin width is 1<<ca ticks
+                        msb = getInt(); //bins
+                        tmp_int2 = getInt(); //timeout in Timer5 rollovers (262mS)
+                        if ((value & 0xF) > 4 || (value >> 4) > HISTOGRAM_LOW || msb == 0 || msb > BUFFER_SIZE || ca > 31) {
+                            RESPONSE = ARGUMENT_ERROR;
+                            break;
+                        }
+                        LEDPIN = 0;
+                        sendChar(timing_histogram(value & 0xF, value >> 4, lsb, ((unsigned long) l2 << 16) | l1, ca, msb, tmp_int2));
+                        LEDPIN = 1;
+                        sendInt(HISTOGRAM_COUNT);
+                        sendInt(HISTOGRAM_UNDER);
+                        sendInt(HISTOGRAM_OVER);
+                        sendLong(HISTOGRAM_MIN & 0xFFFF, HISTOGRAM_MIN >> 16);
+                        sendLong(HISTOGRAM_MAX & 0xFFFF, HISTOGRAM_MAX >> 16);
+                        sendLong(HISTOGRAM_MEAN & 0xFFFF, HISTOGRAM_MEAN >> 16);
+                        for (i = 0; i < msb; i++)sendInt(ADCbuffer[i]);
+                        break;
+
                     case GET_ALTERNATE_HIGH_FREQUENCY: //This one shares TIMER5 with the ADC and uses also uses timers from the input capture module. We're running out of timers and modules :/
                         LEDPIN = 0;
                         value = getChar();
@@ -968,6 +1636,21 @@ int main() {
                         for (i = lsb; i < msb + lsb; i++) ADCbuffer[i] = 0;
                         break;
 
+                    case ARM_SYNC_START: //the following SET_SINE/SQR/SET_DDS/CAPTURE commands set up without starting
+                        SYNC_HOLD = getChar() & 0xF; //SYNC_* bits. 0 cancels
+                        break;
+
+                    case SYNC_START: //start every held timer in one go
+                        value = SYNC_HOLD;
+                        sync_start(value, dest);
+                        sendChar(value);
+                        for (cb = 0; cb < SYNC_TIMERS && !((value >> cb)&1); cb++); //slot of the first timer started
+                        for (i = 0; i < SYNC_TIMERS; i++) { //Timer5, Timer3, Timer4, Timer1
+                            sendChar(((value >> i)&1) ? i - cb : SYNC_NOT_STARTED); //one mov per slot : Fcy cycles after the first start
+                            sendInt(dest[i]); //counts read back right after the start
+                        }
+                        break;
+
                     case FILL_BUFFER:
                         lsb = getInt(); //starting point
                         msb = getInt(); //number of bytes